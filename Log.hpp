@@ -23,17 +23,36 @@
     format_time->tm_year+1900 tm_mon+1 tm_mday tm_hour tm_min tm_sec
 
     宏定义获取文件名 __FILE__ 行号 __LINE__ 可变参数##__VA_ARGS__
+
+ * 异步输出：
+ *  打日志的线程只负责格式化，把整行日志拷贝进一个固定大小的环形缓冲区（多生产者单消费者，每个槽位带序号，无锁）
+ *  后台线程把缓冲区中的日志攒成一批，一次write写到文件（日志文件只打开一次）或者标准输出
+ *  缓冲区满时打日志的线程等待后台线程腾出位置，不会丢日志；ERROR、FATAL会立即唤醒后台线程，FATAL等到写出后才返回
+ *  进程正常退出时（main返回或者exit）会把剩余的日志写完；日志写入器分配后不再释放，
+ *  main返回后仍在运行的detach线程（增量段合并、重新加载索引等）打日志也不会写进已经析构的缓冲区
+ *  日志等级低于set_log_level设置的等级时，LOG宏直接跳过，参数都不会求值；也可以用环境变量LOG_LEVEL=info等指定
+ *  时间字符串每个线程缓存一份，同一秒内的日志不再重复格式化
  */
 
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <algorithm>
 #include <cstdio>
 #include <ctime>
 #include <cstring>
 #include <cstdarg>
+#include <cstdlib>
+#include <strings.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 //日志等级
 enum Level{
@@ -59,48 +78,247 @@ std::string file_name = "log.log";
         is_save = false;\
     }while(0)
 
+std::string get_time();//获取当前时间
+std::string get_level(Level); //获取日志等级
+
+//环境变量LOG_LEVEL指定的最低日志等级，没有指定时输出所有日志
+int default_log_level(){
+    const char* env = getenv("LOG_LEVEL");
+    if(env == nullptr) return DEBUG;
+    for(int level = DEBUG;level<=FATAL;level++){
+        if(strcasecmp(env,get_level((Level)level).c_str()) == 0){
+            return level;
+        }
+    }
+    return DEBUG;
+}
+
+//低于这个等级的日志直接丢弃，运行中可以随时修改
+std::atomic<int> log_level{default_log_level()};
+
+void set_log_level(Level level){
+    log_level.store(level,std::memory_order_relaxed);
+}
 
-#define LOG(level,format,...)                                      \
-    do{                                                            \
-        log_message(__FILE__,__LINE__,level,format,##__VA_ARGS__); \
+#define LOG(level,format,...)                                          \
+    do{                                                                \
+        if((int)(level)>=log_level.load(std::memory_order_relaxed)){   \
+            log_message(__FILE__,__LINE__,level,format,##__VA_ARGS__); \
+        }                                                              \
     }while(0)
 
-void save_file(std::string); //保存到文件中
-std::string get_time();//获取当前时间
-std::string get_level(Level); //获取日志等级
+const size_t LOG_MESSAGE_SIZE = 1024;//自定义消息的最大长度，和原来的格式化缓冲区一致
+const size_t LOG_LINE_SIZE = 1536;//一整行日志的最大长度，超出部分截断
+const size_t LOG_RING_SIZE = 1024;//环形缓冲区的槽位数，必须是2的幂
+const size_t LOG_BATCH_SIZE = 64<<10;//后台线程每次最多攒这么多字节再写出
+
+/**
+ * 异步日志：有界的多生产者单消费者环形缓冲区 + 后台写线程
+ * 每个槽位的seq表示它的状态：seq == pos 可写，seq == pos+1 已写好等待输出，输出后设为pos+LOG_RING_SIZE留给下一轮
+ * 生产者用CAS抢占tail上的位置，消费者只有后台线程一个，head不需要原子的读改写
+ */
+class async_logger{
+private:
+    struct log_slot{
+        std::atomic<uint64_t> seq;
+        uint32_t len;
+        bool to_file;
+        char data[LOG_LINE_SIZE];
+    };
+    log_slot* ring;
+    alignas(64) std::atomic<uint64_t> tail{0};//下一个要抢占的位置
+    alignas(64) std::atomic<uint64_t> head{0};//下一个要输出的位置，只有后台线程修改
+    std::atomic<uint64_t> written{0};//已经写出的日志条数，flush用它判断自己的日志是否写出
+    std::mutex mtx;
+    std::condition_variable wake_cv;//唤醒后台线程
+    std::condition_variable done_cv;//通知等待flush的线程
+    bool stop = false;
+    std::once_flag start_flag;
+    std::thread flusher;
+    int fd = -1;//日志文件，第一次写文件时打开
+    std::string path;//日志文件路径，构造时拷贝一份，退出时全局的file_name析构后仍然可用
+public:
+    async_logger()
+    :path(file_name)
+    {
+        ring = new log_slot[LOG_RING_SIZE];
+        for(size_t i = 0;i<LOG_RING_SIZE;i++){
+            ring[i].seq.store(i,std::memory_order_relaxed);
+        }
+    }
+    async_logger(const async_logger&) = delete;
+    async_logger& operator=(const async_logger&) = delete;
+    ~async_logger(){
+        if(flusher.joinable()){
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop = true;
+            }
+            wake_cv.notify_one();
+            flusher.join();
+        }
+        if(fd>=0) close(fd);
+        delete[] ring;
+    }
 
-void log_message(std::string file_name,int line,Level level,const char* format,...){
-    //获取当前时间
-    std::string time_ = get_time();
-    std::string level_ = get_level(level);
-    pid_t pid = getpid();
-    char buff[1024];
+    //把一行日志放进缓冲区，返回它的位置；缓冲区满时等后台线程腾出位置
+    uint64_t push(const char* line,size_t len,bool to_file,bool urgent){
+        std::call_once(start_flag,[this]{ flusher = std::thread(&async_logger::run,this); });
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        log_slot* slot;
+        while(true){
+            slot = &ring[pos&(LOG_RING_SIZE-1)];
+            uint64_t seq = slot->seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)seq-(int64_t)pos;
+            if(diff == 0){
+                if(tail.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){
+                    break;
+                }
+            }else if(diff<0){
+                //满了，这个槽位上一轮的日志还没有写出
+                wake_cv.notify_one();
+                std::this_thread::yield();
+                pos = tail.load(std::memory_order_relaxed);
+            }else{
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        memcpy(slot->data,line,len);
+        slot->len = len;
+        slot->to_file = to_file;
+        slot->seq.store(pos+1,std::memory_order_release);
+        //后台线程空闲时每隔一段时间自己醒来，只在需要尽快写出或者快满了的时候才唤醒它
+        if(urgent||pos-head.load(std::memory_order_relaxed)>=LOG_RING_SIZE/2){
+            wake_cv.notify_one();
+        }
+        return pos;
+    }
+
+    //等待位置pos及之前的日志全部写出
+    void flush(uint64_t pos){
+        std::unique_lock<std::mutex> lock(mtx);
+        wake_cv.notify_one();
+        done_cv.wait(lock,[&]{ return written.load(std::memory_order_acquire)>pos||stop; });
+    }
+private:
+    void run(){
+        std::string file_batch,out_batch;
+        file_batch.reserve(LOG_BATCH_SIZE);
+        out_batch.reserve(LOG_BATCH_SIZE);
+        while(true){
+            //攒一批日志，按写入目标分开
+            uint64_t pos = head.load(std::memory_order_relaxed);
+            while(file_batch.size()+out_batch.size()<LOG_BATCH_SIZE){
+                log_slot& slot = ring[pos&(LOG_RING_SIZE-1)];
+                if(slot.seq.load(std::memory_order_acquire)!=pos+1){
+                    break;
+                }
+                (slot.to_file?file_batch:out_batch).append(slot.data,slot.len);
+                slot.seq.store(pos+LOG_RING_SIZE,std::memory_order_release);
+                pos++;
+            }
+            head.store(pos,std::memory_order_relaxed);
+            if(!file_batch.empty()){
+                write_file(file_batch);
+                file_batch.clear();
+            }
+            if(!out_batch.empty()){
+                fwrite(out_batch.data(),1,out_batch.size(),stdout);
+                fflush(stdout);
+                out_batch.clear();
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            if(written.load(std::memory_order_relaxed)!=pos){
+                written.store(pos,std::memory_order_release);
+                done_cv.notify_all();
+            }
+            if(ready(pos)){
+                continue;
+            }
+            if(stop){
+                //生产者可能抢占了位置还没写完，等它写完再退出
+                if(tail.load(std::memory_order_acquire) == pos) break;
+                lock.unlock();
+                std::this_thread::yield();
+                continue;
+            }
+            wake_cv.wait_for(lock,std::chrono::milliseconds(50));
+        }
+    }
+
+    bool ready(uint64_t pos) const {
+        return ring[pos&(LOG_RING_SIZE-1)].seq.load(std::memory_order_acquire) == pos+1;
+    }
+
+    void write_file(const std::string& batch){
+        if(fd<0){
+            fd = open(path.c_str(),O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+            if(fd<0) return;
+        }
+        size_t off = 0;
+        while(off<batch.size()){
+            ssize_t n = write(fd,batch.data()+off,batch.size()-off);
+            if(n<=0) return;
+            off+=n;
+        }
+    }
+};
+
+void log_flush();
+
+//第一次打日志时创建后台线程和缓冲区，之后一直不释放；进程退出时atexit只把剩余的日志写出，不停止后台线程
+async_logger& log_writer(){
+    static async_logger* writer = []{
+        async_logger* created = new async_logger();
+        atexit(log_flush);
+        return created;
+    }();
+    return *writer;
+}
+
+//当前时间的"[时间]"前缀，每个线程缓存一份，秒数不变时直接复用
+const std::string& cached_time_prefix(){
+    static thread_local time_t last = -1;
+    static thread_local std::string prefix;
+    time_t now = time(nullptr);
+    if(now!=last){
+        last = now;
+        prefix = "["+get_time()+"]";
+    }
+    return prefix;
+}
+
+void log_message(const char* file_name,int line,Level level,const char* format,...){
+    static const std::string& pid = *new std::string("["+std::to_string(getpid())+"]");//同样不析构
+    //整行日志直接格式化到栈上的缓冲区里，不生成临时字符串
+    char buff[LOG_LINE_SIZE];
+    const std::string& time_ = cached_time_prefix();
+    int len = snprintf(buff,LOG_LINE_SIZE-LOG_MESSAGE_SIZE,"%s[%s]%s[%s][%d][",
+                       time_.c_str(),get_level(level).c_str(),pid.c_str(),file_name,line);
+    len = std::min(len,(int)(LOG_LINE_SIZE-LOG_MESSAGE_SIZE-1));
     va_list arg;
     va_start(arg,format);
-    vsnprintf(buff,sizeof(buff),format,arg);
+    int n = vsnprintf(buff+len,LOG_MESSAGE_SIZE,format,arg);
     va_end(arg);
-    std::string message = "["+time_+"]"+"["+level_+"]"+"["+std::to_string(pid)+"]"+"["+file_name+"]"+
-                            "["+std::to_string(line)+"]"+"["+buff+"]"+"\n";
-    if(is_save){
-        save_file(message);
-    }else{
-        std::cout<<message;
+    len+=std::max(0,std::min(n,(int)LOG_MESSAGE_SIZE-1));
+    buff[len++] = ']';
+    buff[len++] = '\n';
+    uint64_t pos = log_writer().push(buff,len,is_save,level>=ERROR);
+    if(level == FATAL){
+        log_writer().flush(pos);
     }
-    
 }
 
-void save_file(std::string message){
-    std::ofstream outfile(file_name,std::ios::app);//追加模式
-    if(!outfile.is_open()){
-        return;
-    }    
-    outfile<<message;
-    outfile.close();
+//等待之前的日志全部写出
+void log_flush(){
+    log_writer().flush(log_writer().push("",0,is_save,true));
 }
 
 std::string get_time(){
     time_t time_cur = time(nullptr);
-    struct tm* format_time = localtime(&time_cur);
+    struct tm tm_cur;
+    //localtime返回的是静态缓冲区，多线程下要用可重入的localtime_r
+    struct tm* format_time = localtime_r(&time_cur,&tm_cur);
     if(format_time == nullptr) return "null";
     //格式化转为字符串
     return std::to_string(format_time->tm_year+1900)+":"
@@ -133,4 +351,4 @@ std::string get_level(Level level){
         return "nullptr";
         break;
     }
-}
\ No newline at end of file
+}
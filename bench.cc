@@ -0,0 +1,230 @@
+/**
+ * yui的boost搜索引擎，压测工具
+ * 从查询文件（每行一个查询）或者http_server的日志（log.log中的query:xxx）读取查询，循环发起搜索，
+ * 统计QPS和延迟分位数(p50/p95/p99/p999)，用来在上线前发现搜索路径上的性能退化
+ *
+ * 两种压测对象：
+ *  direct：在进程内直接调用Searcher::search，只测分词、打分、生成json的开销
+ *  http：通过cpp-httplib客户端请求http_server的/s接口，包含网络和HTTP框架的开销
+ * 两种发压方式：
+ *  闭环(closed loop，默认)：每个线程发完一个请求、收到结果后马上发下一个，测的是最大吞吐
+ *  开环(open loop，-r指定总速率)：按固定速率安排每个请求的发送时间，不管前面的请求有没有返回，
+ *  延迟从计划发送时间开始计算，服务变慢时排队的时间也会算进延迟里，不会因为发压方被拖慢而低估延迟
+ *
+ * 用法：./bench [选项]
+ *  -f 查询文件        每行一个查询
+ *  -l 日志文件        从日志的query:xxx中提取查询（-f和-l二选一，默认读log.log）
+ *  -m direct|http     压测对象，默认direct
+ *  -c 并发线程数      默认1
+ *  -n 请求总数        默认为查询数
+ *  -d 持续秒数        指定后按时间压测，忽略-n
+ *  -r 每秒请求数      开环压测的总速率，0表示闭环，默认0；开环时并发线程数要足够多，否则发压方自己会跟不上速率
+ *  -h 地址 -p 端口    http模式下的服务地址，默认127.0.0.1:8080
+ *  -i raw.txt -s 快照 direct模式下加载的索引，默认和http_server一致
+ *  -k 缓存字节数      direct模式下的查询结果缓存大小，默认0（不缓存）
+ *  -q 每页结果数      默认10
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "cpp-httplib/httplib.h"
+#include "Log.hpp"
+#include "searcher.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+const std::string input = "data/raw_html/raw.txt";
+const std::string index_path = "data/raw_html/index.bin";
+
+struct bench_options{
+    std::string query_file;
+    std::string log_file = "log.log";
+    std::string mode = "direct";
+    size_t concurrency = 1;
+    size_t total = 0;
+    double duration = 0;
+    double rate = 0;
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string raw_file = input;
+    std::string snapshot = index_path;
+    size_t cache_capacity = 0;
+    size_t page_size = DEFAULT_PAGE_SIZE;
+};
+
+//每个压测线程自己的统计，结束后再合并，压测过程中线程之间不共享可写数据
+struct bench_result{
+    std::vector<double> latencies;//微秒
+    size_t errors = 0;
+    size_t bytes = 0;
+};
+
+//读取查询：每行一个查询；日志文件中只取query:后面的内容
+bool load_queries(const std::string& path,bool from_log,std::vector<std::string>* queries){
+    std::ifstream in(path);
+    if(!in.is_open()){
+        LOG(FATAL,"%s打开失败",path.c_str());
+        return false;
+    }
+    const std::string tag = "[query:";
+    std::string line;
+    while(std::getline(in,line)){
+        if(from_log){
+            size_t pos = line.find(tag);
+            size_t end = line.rfind(']');
+            if(pos == std::string::npos||end == std::string::npos||end<pos+tag.size()){
+                continue;
+            }
+            line = line.substr(pos+tag.size(),end-pos-tag.size());
+        }
+        if(!line.empty()&&line.back() == '\r'){
+            line.pop_back();
+        }
+        if(!line.empty()){
+            queries->push_back(line);
+        }
+    }
+    return true;
+}
+
+//排好序的延迟中取第p分位
+double percentile(const std::vector<double>& sorted,double p){
+    if(sorted.empty()) return 0;
+    size_t rank = (size_t)std::ceil(p*sorted.size());
+    if(rank == 0) rank = 1;
+    return sorted[std::min(rank,sorted.size())-1];
+}
+
+void usage(const char* name){
+    fprintf(stderr,"usage: %s [-f queries|-l log] [-m direct|http] [-c threads] [-n requests] [-d seconds] "
+                   "[-r qps] [-h host] [-p port] [-i raw.txt] [-s snapshot] [-k cache_bytes] [-q page_size]\n",name);
+}
+
+int main(int argc,char* argv[])
+{
+    bench_options opt;
+    int ch;
+    while((ch = getopt(argc,argv,"f:l:m:c:n:d:r:h:p:i:s:k:q:")) != -1){
+        switch(ch){
+        case 'f': opt.query_file = optarg; break;
+        case 'l': opt.log_file = optarg; break;
+        case 'm': opt.mode = optarg; break;
+        case 'c': opt.concurrency = std::max(1ul,strtoul(optarg,nullptr,10)); break;
+        case 'n': opt.total = strtoul(optarg,nullptr,10); break;
+        case 'd': opt.duration = atof(optarg); break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 'h': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 'i': opt.raw_file = optarg; break;
+        case 's': opt.snapshot = optarg; break;
+        case 'k': opt.cache_capacity = strtoul(optarg,nullptr,10); break;
+        case 'q': opt.page_size = strtoul(optarg,nullptr,10); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if(opt.mode!="direct"&&opt.mode!="http"){
+        usage(argv[0]);
+        return 1;
+    }
+    if(opt.page_size == 0||opt.page_size>MAX_PAGE_SIZE){
+        opt.page_size = DEFAULT_PAGE_SIZE;
+    }
+
+    std::vector<std::string> queries;
+    bool from_log = opt.query_file.empty();
+    if(!load_queries(from_log?opt.log_file:opt.query_file,from_log,&queries)){
+        return 2;
+    }
+    if(queries.empty()){
+        LOG(FATAL,"没有读到任何查询");
+        return 2;
+    }
+    if(opt.total == 0){
+        opt.total = queries.size();
+    }
+
+    Searcher searcher;
+    if(opt.mode == "direct"){
+        able_save();//压测时查不到字词的警告写到日志文件里，不要刷屏
+        searcher.init_search(opt.raw_file,opt.snapshot,true);
+        searcher.set_cache_capacity(opt.cache_capacity);
+    }
+
+    //next为下一个要发的请求的序号，所有线程从这里领任务
+    //开环时第i个请求的计划发送时间为begin+i/rate
+    std::atomic<size_t> next{0};
+    std::vector<bench_result> results(opt.concurrency);
+    bench_clock::time_point begin = bench_clock::now();
+    bench_clock::time_point deadline = begin+std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(opt.duration));
+
+    auto worker = [&](size_t tid){
+        bench_result& res = results[tid];
+        std::unique_ptr<httplib::Client> client;
+        if(opt.mode == "http"){
+            client.reset(new httplib::Client(opt.host,opt.port));
+            client->set_keep_alive(true);
+            client->set_tcp_nodelay(true);//关掉Nagle，否则小请求会被延迟确认拖慢几十毫秒
+        }
+        std::string json;
+        while(true){
+            size_t i = next.fetch_add(1,std::memory_order_relaxed);
+            if(opt.duration<=0&&i>=opt.total){
+                break;
+            }
+            bench_clock::time_point start = bench_clock::now();
+            if(opt.rate>0){
+                start = begin+std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(i/opt.rate));
+                std::this_thread::sleep_until(start);
+            }
+            if(opt.duration>0&&start>=deadline){
+                break;
+            }
+            const std::string& query = queries[i%queries.size()];
+            if(client){
+                httplib::Params params{{"query",query},{"start","0"},{"count",std::to_string(opt.page_size)}};
+                auto r = client->Get("/s",params,httplib::Headers());
+                if(!r||r->status!=200){
+                    res.errors++;
+                    continue;
+                }
+                res.bytes+=r->body.size();
+            }else{
+                searcher.search(query,json,0,opt.page_size);
+                res.bytes+=json.size();
+            }
+            res.latencies.push_back(std::chrono::duration<double,std::micro>(bench_clock::now()-start).count());
+        }
+    };
+    std::vector<std::thread> threads;
+    for(size_t i = 0;i<opt.concurrency;i++){
+        threads.emplace_back(worker,i);
+    }
+    for(std::thread& t:threads){
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(bench_clock::now()-begin).count();
+
+    std::vector<double> all;
+    size_t errors = 0,bytes = 0;
+    for(bench_result& res:results){
+        all.insert(all.end(),res.latencies.begin(),res.latencies.end());
+        errors+=res.errors;
+        bytes+=res.bytes;
+    }
+    std::sort(all.begin(),all.end());
+    double sum = 0;
+    for(double v:all) sum+=v;
+    printf("mode=%s loop=%s threads=%zu queries=%zu\n",opt.mode.c_str(),opt.rate>0?"open":"closed",opt.concurrency,queries.size());
+    printf("requests=%zu errors=%zu elapsed=%.3fs qps=%.1f bytes=%zu\n",all.size(),errors,elapsed,elapsed>0?all.size()/elapsed:0.0,bytes);
+    printf("latency(us) avg=%.1f p50=%.1f p95=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+           all.empty()?0.0:sum/all.size(),percentile(all,0.50),percentile(all,0.95),percentile(all,0.99),
+           percentile(all,0.999),all.empty()?0.0:all.back());
+    return errors == 0?0:3;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，打分篇
+原来的权重是 标题出现次数*5 + 正文出现次数*1，没有idf也没有长度归一化，
+满篇模板文字的长页面词频高，总是排在前面。现在改成BM25F：
+  tf~ = Σ 字段权重 * 字段词频 / ((1-b) + b * 字段长度/字段平均长度)      (标题、正文两个字段)
+  score(词,文档) = idf(词) * tf~ * (k1+1) / (tf~ + k1)
+  idf(词) = ln(1 + (N - df + 0.5) / (df + 0.5))
+后半部分只和文档有关、前半部分只和词有关，所以都在建索引时算好：
+- 倒排元素的1字节权重保存 tf~*(k1+1)/(tf~+k1) * BM25_TF_SCALE，文档长度归一化已经包含在里面，
+  取值范围[1,(k1+1)*BM25_TF_SCALE)，落在weight_table精确保存的区间内
+- 每个词的idf * BM25_IDF_SCALE保存在词典（posting_meta.idf）里
+查询时每个倒排元素只需要一次乘法和一次加法；块内最大权重、整条拉链最大权重都乘上同一个idf，
+仍然是WAND剪枝的有效上界
+字段长度是分词后（去掉停用词）的词数，平均长度和文档数记在快照文件头里，增量段用它们给新文档打分
+*/
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+//BM25参数：k1控制词频饱和的速度，b控制长度归一化的强度，标题很短，归一化弱一些
+const double BM25_K1 = 1.2;
+const double BM25_TITLE_B = 0.5;
+const double BM25_CONTENT_B = 0.75;
+//字段权重，标题中出现一次相当于正文中出现5次
+const double BM25_TITLE_WEIGHT = 5;
+const double BM25_CONTENT_WEIGHT = 1;
+//定点数的放大倍数，(k1+1)*BM25_TF_SCALE = 110 < 128
+const int BM25_TF_SCALE = 50;
+const int BM25_IDF_SCALE = 100;
+
+//一个词在一个文档中的词频
+struct term_freq{
+    uint32_t title = 0;
+    uint32_t content = 0;
+};
+
+//一个文档各字段的长度（词数）
+struct doc_length{
+    uint32_t title = 0;
+    uint32_t content = 0;
+};
+
+//打分用的全局统计：文档数和各字段的总词数
+struct bm25_stats{
+    uint64_t doc_count = 0;
+    uint64_t title_tokens = 0;
+    uint64_t content_tokens = 0;
+
+    void add(const doc_length& length){
+        doc_count++;
+        title_tokens+=length.title;
+        content_tokens+=length.content;
+    }
+    double avg_title() const {
+        return doc_count == 0||title_tokens == 0?1.0:(double)title_tokens/doc_count;
+    }
+    double avg_content() const {
+        return doc_count == 0||content_tokens == 0?1.0:(double)content_tokens/doc_count;
+    }
+};
+
+//倒排元素的权重（已归一化、饱和的词频部分），至少为1，保证出现过的词都有分
+inline int bm25_tf(const term_freq& tf,const doc_length& length,const bm25_stats& stats){
+    double title_norm = (1-BM25_TITLE_B)+BM25_TITLE_B*length.title/stats.avg_title();
+    double content_norm = (1-BM25_CONTENT_B)+BM25_CONTENT_B*length.content/stats.avg_content();
+    double tf_sum = BM25_TITLE_WEIGHT*tf.title/title_norm+BM25_CONTENT_WEIGHT*tf.content/content_norm;
+    double value = tf_sum*(BM25_K1+1)/(tf_sum+BM25_K1);
+    return std::max(1,(int)std::lround(value*BM25_TF_SCALE));
+}
+
+//词的idf，df为包含这个词的文档数，至少为1，非常常见的词也保留一点区分度
+inline uint32_t bm25_idf(uint64_t doc_count,uint64_t df){
+    df = std::min(df,doc_count);
+    double value = std::log(1+(doc_count-df+0.5)/(df+0.5));
+    return std::max<uint32_t>(1,(uint32_t)std::lround(value*BM25_IDF_SCALE));
+}
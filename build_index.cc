@@ -0,0 +1,42 @@
+/**
+ * yui的boost搜索引擎，离线建索引工具
+ * 读取parser生成的raw.txt，建立正排索引和倒排索引，然后写成二进制快照
+ * http_server启动时直接加载快照，不用再对整个语料重新分词
+ *
+ * raw.txt已经包含了parser -i 产生的所有变更，重建快照后清空变更日志
+ *
+ * 用法：./build_index [raw.txt路径] [快照路径] [建索引线程数，默认为机器核数] [变更日志路径] [是否保存位置信息，默认1]
+ * 不保存位置信息时快照更小，但是短语查询只能要求包含短语中的所有词，也没有邻近度加分，摘要退回到在正文中查找
+ */
+#include <string>
+#include <cstdlib>
+#include "Log.hpp"
+#include "index.hpp"
+
+const std::string input = "data/raw_html/raw.txt";
+const std::string index_path = "data/raw_html/index.bin";
+const std::string delta_path = "data/raw_html/delta.txt";
+
+int main(int argc,char* argv[])
+{
+    able_save();
+    std::string raw_file = argc>1?argv[1]:input;
+    std::string snapshot = argc>2?argv[2]:index_path;
+    int thread_num = argc>3?atoi(argv[3]):0;
+    std::string delta = argc>4?argv[4]:delta_path;
+    bool positions = argc>5?atoi(argv[5])!=0:true;
+    Index* index = Index::get_instance();
+    index->set_store_positions(positions);
+    if(!index->create_index(raw_file,thread_num)){
+        LOG(FATAL,"%s建立索引失败",raw_file.c_str());
+        return 1;
+    }
+    LOG(INFO,"建立索引成功");
+    if(!index->save_index(snapshot)){
+        LOG(FATAL,"%s保存索引快照失败",snapshot.c_str());
+        return 2;
+    }
+    LOG(INFO,"保存索引快照成功");
+    index->reset_delta(delta);
+    return 0;
+}
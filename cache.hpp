@@ -0,0 +1,155 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，查询结果缓存篇
+线上的查询非常集中，少数热门查询（shared_ptr、asio……）占了大部分请求，
+每次都重新分词、打分、生成json很浪费，所以在Searcher::search前面加一层结果缓存：
+key：分词并转小写之后的查询词序列 + 分页参数（由Searcher拼出来）
+value：最终返回给前端的json串
+淘汰策略：LRU，按字节数限制内存，容量为0时不缓存
+为了减少多线程下的锁竞争，缓存按key的哈希分成多个分片，每个分片一把锁、一条LRU链表
+命中/未命中/淘汰次数用原子变量统计，可以随时读取
+*/
+
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+//缓存的统计信息
+struct cache_stats{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+    uint64_t evictions = 0;
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t capacity = 0;
+};
+
+/**
+ * 分片的LRU缓存，按字节数限制内存，容量为0时不缓存
+ * Size(key,value)给出一项缓存大约占用的字节数，Hash决定key落在哪个分片
+ * 查询结果缓存和正文的解压块缓存（docstore.hpp）都是它的实例
+ */
+template<class Key,class Value,class Size,class Hash = std::hash<Key>>
+class sharded_lru_cache{
+public:
+    //capacity为所有分片加起来的字节上限
+    explicit sharded_lru_cache(size_t capacity = 0,size_t shard_num = 16)
+    :capacity_(capacity)
+    {
+        if(shard_num == 0) shard_num = 1;
+        for(size_t i = 0;i<shard_num;i++){
+            shards_.emplace_back(new shard());
+        }
+        shard_capacity_ = capacity/shard_num;
+    }
+    sharded_lru_cache(const sharded_lru_cache&) = delete;
+    sharded_lru_cache& operator=(const sharded_lru_cache&) = delete;
+
+    //查找缓存，命中时把结果拷贝到value中，并把该项移到LRU链表头部
+    bool get(const Key& key,Value* value){
+        if(capacity_ == 0){
+            misses_.fetch_add(1,std::memory_order_relaxed);
+            return false;
+        }
+        shard& s = get_shard(key);
+        {
+            std::lock_guard<std::mutex> lock(s.mtx);
+            auto iter = s.map.find(key);
+            if(iter!=s.map.end()){
+                s.lru.splice(s.lru.begin(),s.lru,iter->second);
+                *value = iter->second->second;
+                hits_.fetch_add(1,std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses_.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+
+    //插入缓存，超过分片容量时从LRU链表尾部开始淘汰
+    void put(const Key& key,const Value& value){
+        size_t size = Size()(key,value);
+        if(capacity_ == 0||size>shard_capacity_){
+            return;
+        }
+        shard& s = get_shard(key);
+        std::lock_guard<std::mutex> lock(s.mtx);
+        auto iter = s.map.find(key);
+        if(iter!=s.map.end()){
+            //已经有了（多个线程同时未命中同一个key），只需要更新位置
+            s.lru.splice(s.lru.begin(),s.lru,iter->second);
+            return;
+        }
+        s.lru.emplace_front(key,value);
+        s.map[key] = s.lru.begin();
+        s.bytes+=size;
+        inserts_.fetch_add(1,std::memory_order_relaxed);
+        while(s.bytes>shard_capacity_&&!s.lru.empty()){
+            auto& last = s.lru.back();
+            s.bytes-=Size()(last.first,last.second);
+            s.map.erase(last.first);
+            s.lru.pop_back();
+            evictions_.fetch_add(1,std::memory_order_relaxed);
+        }
+    }
+
+    //清空缓存（例如索引更新之后）
+    void clear(){
+        for(auto& s:shards_){
+            std::lock_guard<std::mutex> lock(s->mtx);
+            s->map.clear();
+            s->lru.clear();
+            s->bytes = 0;
+        }
+    }
+
+    cache_stats get_stats(){
+        cache_stats stats;
+        stats.hits = hits_.load(std::memory_order_relaxed);
+        stats.misses = misses_.load(std::memory_order_relaxed);
+        stats.inserts = inserts_.load(std::memory_order_relaxed);
+        stats.evictions = evictions_.load(std::memory_order_relaxed);
+        stats.capacity = capacity_;
+        for(auto& s:shards_){
+            std::lock_guard<std::mutex> lock(s->mtx);
+            stats.entries+=s->map.size();
+            stats.bytes+=s->bytes;
+        }
+        return stats;
+    }
+private:
+    using entry = std::pair<Key,Value>;
+    struct shard{
+        std::mutex mtx;
+        std::list<entry> lru;//头部是最近使用的
+        std::unordered_map<Key,typename std::list<entry>::iterator,Hash> map;
+        size_t bytes = 0;
+    };
+
+    shard& get_shard(const Key& key){
+        return *shards_[Hash()(key)%shards_.size()];
+    }
+private:
+    size_t capacity_;
+    size_t shard_capacity_;
+    std::vector<std::unique_ptr<shard>> shards_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> inserts_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+//一项查询结果缓存大约占用的内存：key和value各存了一份，再加上链表节点和哈希表节点的开销
+struct result_entry_size{
+    size_t operator()(const std::string& key,const std::string& value) const {
+        return key.size()*2+value.size()+128;
+    }
+};
+
+using result_cache = sharded_lru_cache<std::string,std::string,result_entry_size>;
@@ -0,0 +1,241 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，正文存储篇
+正排索引里最占内存的是每个文档去掉标签后的正文，而正文只在给返回的这一页结果生成摘要时才用到
+（一页最多几十个文档），所以正文不再和标题、url一起原样保存，而是压缩存放：
+1.按文档id的顺序把正文依次拼接，攒够DOC_STORE_BLOCK_SIZE字节就压缩成一块（zlib），
+  比这还长的正文自己单独一块；块表(doc_block)记录每块在压缩数据区中的位置和解压后的长度
+2.每个文档只需要记下 所在的块、在解压后的块中的偏移、长度（content_ref），和块表一样是定长的POD，
+  快照中直接放在doc_entry里
+3.读取正文时解压整块，解压后的块放进一个按字节数限制大小的LRU缓存（doc_block_cache），
+  同一块中的文档、翻页和热门查询都可以直接命中；解压结果用shared_ptr持有，被淘汰时正在使用它的查询不受影响
+标题和url很短、每个结果都要用，仍然不压缩
+块表和压缩数据区可以属于存储自己（建索引、从快照读入堆内存），也可以指向mmap的快照（attach）
+*/
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <cstdint>
+#include <zlib.h>
+#include "cache.hpp"
+
+//攒够这么多字节的正文压缩成一块：块越大压缩率越高，但读一个文档要解压的数据也越多
+const size_t DOC_STORE_BLOCK_SIZE = 16<<10;
+//zlib的压缩级别，只在建索引时压缩一次，解压速度和级别基本无关
+const int DOC_STORE_LEVEL = 6;
+//解压块缓存的内存上限
+const size_t DOC_CACHE_CAPACITY = 16<<20;
+
+//压缩块，offset为在压缩数据区中的偏移
+struct doc_block{
+    uint64_t offset;
+    uint32_t size;//压缩后的字节数
+    uint32_t raw_size;//解压后的字节数
+};
+
+//一个文档的正文在存储中的位置
+struct content_ref{
+    uint32_t block;
+    uint32_t offset;//在解压后的块中的偏移
+    uint32_t size;
+};
+
+//解压块的LRU缓存按解压后的字节数限制内存，块号直接作为key
+struct doc_block_size{
+    size_t operator()(uint32_t,const std::shared_ptr<const std::string>& text) const {
+        return text->size();
+    }
+};
+
+using doc_block_cache = sharded_lru_cache<uint32_t,std::shared_ptr<const std::string>,doc_block_size>;
+
+//把正文按顺序压缩成块：依次add每个文档的正文，最后finish，再append到doc_store
+//不同的builder互不相关，可以把文档分成几段在多个线程中同时压缩，再按顺序append
+class doc_store_builder{
+public:
+    //追加一个文档的正文，返回它的位置，块号从0开始，append到doc_store时再加上已有的块数
+    content_ref add(std::string_view content){
+        if(!pending_.empty()&&pending_.size()+content.size()>DOC_STORE_BLOCK_SIZE){
+            flush();
+        }
+        content_ref ref{(uint32_t)blocks_.size(),(uint32_t)pending_.size(),(uint32_t)content.size()};
+        pending_.append(content.data(),content.size());
+        if(pending_.size()>=DOC_STORE_BLOCK_SIZE){
+            flush();
+        }
+        return ref;
+    }
+    //压缩最后一块不满的数据，有任何一块压缩失败时返回false，这时builder中的块不能再append到doc_store
+    bool finish(){
+        if(!pending_.empty()){
+            flush();
+        }
+        std::string().swap(pending_);
+        return !failed_;
+    }
+private:
+    void flush(){
+        uLongf size = compressBound(pending_.size());
+        uint64_t offset = data_.size();
+        data_.resize(offset+size);
+        if(compress2(data_.data()+offset,&size,(const Bytef*)pending_.data(),pending_.size(),DOC_STORE_LEVEL)!=Z_OK){
+            //size不可信，不写这一块，由finish报告失败
+            failed_ = true;
+            data_.resize(offset);
+            pending_.clear();
+            return;
+        }
+        data_.resize(offset+size);
+        blocks_.push_back(doc_block{offset,(uint32_t)size,(uint32_t)pending_.size()});
+        pending_.clear();
+    }
+private:
+    friend class doc_store;
+    std::vector<doc_block> blocks_;
+    std::vector<uint8_t> data_;
+    std::string pending_;
+    bool failed_ = false;
+};
+
+/**
+ * 按块压缩的正文，建好之后只读，多个线程可以同时读取（解压块缓存自己加锁）
+ */
+class doc_store{
+public:
+    doc_store(){}
+    doc_store(const doc_store&) = delete;
+    doc_store& operator=(const doc_store&) = delete;
+
+    //把builder压缩好的块接到后面，返回builder中的块号需要加上的值；builder需要先finish
+    uint32_t append(doc_store_builder& builder){
+        uint32_t block_base = owned_blocks_.size();
+        uint64_t data_base = owned_data_.size();
+        for(doc_block block:builder.blocks_){
+            block.offset+=data_base;
+            owned_blocks_.push_back(block);
+        }
+        owned_data_.insert(owned_data_.end(),builder.data_.begin(),builder.data_.end());
+        builder = doc_store_builder();
+        use_owned();
+        return block_base;
+    }
+
+    //使用外部的数组（mmap的快照），数组需要先用validate检查过，生命周期由调用者保证
+    void attach(const doc_block* blocks,uint64_t count,const uint8_t* data,uint64_t data_size){
+        clear();
+        blocks_ = blocks;
+        count_ = count;
+        data_ = data;
+        data_size_ = data_size;
+    }
+
+    //把外部的数组拷贝一份（从快照读入堆内存），数组需要先用validate检查过
+    void assign(const doc_block* blocks,uint64_t count,const uint8_t* data,uint64_t data_size){
+        owned_blocks_.assign(blocks,blocks+count);
+        owned_data_.assign(data,data+data_size);
+        cache_.clear();
+        use_owned();
+    }
+
+    void clear(){
+        std::vector<doc_block>().swap(owned_blocks_);
+        std::vector<uint8_t>().swap(owned_data_);
+        cache_.clear();
+        blocks_ = nullptr;
+        count_ = 0;
+        data_ = nullptr;
+        data_size_ = 0;
+    }
+
+    void shrink_to_fit(){
+        owned_blocks_.shrink_to_fit();
+        owned_data_.shrink_to_fit();
+        use_owned();
+    }
+
+    /*
+    读取ref处的正文，content指向解压后的块，holder持有这一块，content在holder释放之前有效
+    块损坏、解压失败时返回false
+    */
+    bool read(const content_ref& ref,std::string_view* content,std::shared_ptr<const std::string>* holder) const {
+        if(ref.size == 0){
+            *content = std::string_view();
+            holder->reset();
+            return true;
+        }
+        if(ref.block>=count_){
+            return false;
+        }
+        std::shared_ptr<const std::string> text;
+        if(!cache_.get(ref.block,&text)){
+            const doc_block& block = blocks_[ref.block];
+            auto raw = std::make_shared<std::string>(block.raw_size,'\0');
+            uLongf size = block.raw_size;
+            if(uncompress((Bytef*)&(*raw)[0],&size,data_+block.offset,block.size)!=Z_OK||size!=block.raw_size){
+                return false;
+            }
+            text = raw;
+            cache_.put(ref.block,text);
+        }
+        if((uint64_t)ref.offset+ref.size>text->size()){
+            return false;
+        }
+        *content = std::string_view(text->data()+ref.offset,ref.size);
+        *holder = std::move(text);
+        return true;
+    }
+
+    //写快照用的原始数组
+    const doc_block* blocks() const {
+        return blocks_;
+    }
+    uint64_t block_count() const {
+        return count_;
+    }
+    const uint8_t* data() const {
+        return data_;
+    }
+    uint64_t data_size() const {
+        return data_size_;
+    }
+    //解压后的总字节数
+    uint64_t raw_size() const {
+        uint64_t size = 0;
+        for(uint64_t i = 0;i<count_;i++){
+            size+=blocks_[i].raw_size;
+        }
+        return size;
+    }
+
+    cache_stats get_cache_stats() const {
+        return cache_.get_stats();
+    }
+
+    //检查快照中的块表：每一块都不超出压缩数据区
+    static bool validate(const doc_block* blocks,uint64_t count,uint64_t data_size){
+        for(uint64_t i = 0;i<count;i++){
+            if(blocks[i].offset+blocks[i].size>data_size){
+                return false;
+            }
+        }
+        return true;
+    }
+private:
+    void use_owned(){
+        blocks_ = owned_blocks_.data();
+        count_ = owned_blocks_.size();
+        data_ = owned_data_.data();
+        data_size_ = owned_data_.size();
+    }
+private:
+    std::vector<doc_block> owned_blocks_;
+    std::vector<uint8_t> owned_data_;
+    const doc_block* blocks_ = nullptr;
+    uint64_t count_ = 0;
+    const uint8_t* data_ = nullptr;
+    uint64_t data_size_ = 0;
+    mutable doc_block_cache cache_{DOC_CACHE_CAPACITY};
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，摘要篇
+原来的GetDescWithHighlight对每个结果的整篇正文做一次带tolower的std::search，只找第一个查询词，
+替换时又区分大小写，截取的字节偏移还会把中文字符切成两半。现在改成：
+1.命中的来源：索引保存了位置信息时直接用正文中的字节偏移（Searcher::make_snippet），
+  否则用Aho-Corasick自动机一遍扫描正文，同时找出所有查询词的所有出现，ASCII字母不区分大小写
+2.选窗口：在按偏移排好序的命中上滑动窗口，包含不同查询词最多的一段最好，一样多时命中次数多的好，再一样时取最靠前的
+3.截取：窗口往前取before字节、往后取after字节，起止位置对齐到UTF-8字符边界，高亮窗口中的所有命中，
+  截取的正文直接转义成json字符串写进搜索结果的缓冲区（见json_writer.hpp）
+自动机、命中数组和计数数组都放在snippet_builder里，每个线程一份，查询之间复用，不会反复申请内存
+
+自动机按字节工作，查询词都是合法的UTF-8，开头不会是续字节(10xxxxxx)，所以匹配的起点一定是字符边界
+只做ASCII的大小写折叠，中文等多字节字符按原样比较
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "json_writer.hpp"
+
+//正文中的一次命中：字节偏移、长度和查询词的下标
+struct snippet_hit{
+    uint32_t offset;
+    uint32_t len;
+    uint32_t word;
+};
+
+//ASCII大写字母转小写，其他字节不变
+inline uint8_t ascii_lower(uint8_t c){
+    return c>='A'&&c<='Z'?c+('a'-'A'):c;
+}
+
+/**
+ * 多个查询词的Aho-Corasick自动机
+ * 只在查询词中出现过的字节各占一个字符类，其余字节都是0类（一定回到根），
+ * 转移表是 状态数*字符类数 的稠密数组，已经补全了失败转移，扫描时每个字节只查一次表
+ */
+class term_matcher{
+public:
+    //words为转成小写的查询词，下标就是命中中的word，空串和重复的词忽略
+    void build(const std::vector<std::string>& words){
+        memset(classes_,0,sizeof(classes_));
+        class_count_ = 1;
+        for(const std::string& word:words){
+            for(char ch:word){
+                uint8_t c = ascii_lower(ch);
+                if(classes_[c] == 0){
+                    classes_[c] = class_count_++;
+                }
+            }
+        }
+        for(int c = 'A';c<='Z';c++){
+            classes_[c] = classes_[c-'A'+'a'];
+        }
+        next_.assign(class_count_,0);
+        output_.assign(1,-1);
+        dict_link_.assign(1,0);
+        lengths_.clear();
+        //1.建trie
+        for(size_t i = 0;i<words.size();i++){
+            lengths_.push_back(words[i].size());
+            if(words[i].empty()){
+                continue;
+            }
+            int32_t state = 0;
+            for(char ch:words[i]){
+                int32_t& target = next_[state*class_count_+classes_[ascii_lower(ch)]];
+                if(target == 0){
+                    target = output_.size();
+                    next_.resize(next_.size()+class_count_,0);
+                    output_.push_back(-1);
+                    dict_link_.push_back(0);
+                }
+                state = next_[state*class_count_+classes_[ascii_lower(ch)]];
+            }
+            if(output_[state]<0){
+                output_[state] = i;
+            }
+        }
+        //2.按层遍历，补全失败转移，dict_link_指向失败链上下一个有输出的状态
+        std::vector<int32_t> fail(output_.size(),0);
+        std::vector<int32_t> queue;
+        for(int c = 1;c<class_count_;c++){
+            if(next_[c]!=0){
+                queue.push_back(next_[c]);
+            }
+        }
+        for(size_t head = 0;head<queue.size();head++){
+            int32_t state = queue[head];
+            for(int c = 1;c<class_count_;c++){
+                int32_t& target = next_[state*class_count_+c];
+                int32_t fallback = next_[fail[state]*class_count_+c];
+                if(target == 0){
+                    target = fallback;
+                    continue;
+                }
+                fail[target] = fallback;
+                dict_link_[target] = output_[fallback]>=0?fallback:dict_link_[fallback];
+                queue.push_back(target);
+            }
+        }
+    }
+
+    //一遍扫描text，把所有查询词的出现追加到hits，结果按偏移升序，同一位置长词优先
+    void find_all(std::string_view text,std::vector<snippet_hit>* hits) const {
+        size_t first = hits->size();
+        int32_t state = 0;
+        for(size_t i = 0;i<text.size();i++){
+            uint8_t c = classes_[(uint8_t)text[i]];
+            state = c == 0?0:next_[state*class_count_+c];
+            for(int32_t t = output_[state]>=0?state:dict_link_[state];t>0;t = dict_link_[t]){
+                uint32_t len = lengths_[output_[t]];
+                hits->push_back(snippet_hit{(uint32_t)(i+1-len),len,(uint32_t)output_[t]});
+            }
+        }
+        //按结束位置输出的，重新按起始位置排一下
+        std::sort(hits->begin()+first,hits->end(),[](const snippet_hit& a,const snippet_hit& b){
+            return a.offset!=b.offset?a.offset<b.offset:a.len>b.len;
+        });
+    }
+private:
+    uint8_t classes_[256] = {0};
+    int class_count_ = 1;
+    std::vector<int32_t> next_;//转移表
+    std::vector<int32_t> output_;//以这个状态结尾的最长查询词，-1表示没有
+    std::vector<int32_t> dict_link_;
+    std::vector<uint32_t> lengths_;
+};
+
+/**
+ * 生成一条结果的摘要，用法：
+ *   set_words(查询词)    每个查询调用一次，需要扫描正文时才建自动机
+ *   clear()              每条结果开始前调用
+ *   add_hit()/scan()     加入命中：来自位置信息，或者扫描正文
+ *   render()             选窗口、截取、高亮
+ */
+class snippet_builder{
+public:
+    void set_words(const std::vector<std::string>& words){
+        words_ = words;
+        //重复的词只保留第一个，后面的改成空串，自动机会忽略空串
+        for(size_t i = 0;i<words_.size();i++){
+            if(std::find(words_.begin(),words_.begin()+i,words_[i])!=words_.begin()+i){
+                words_[i].clear();
+            }
+        }
+        matcher_ready_ = false;
+    }
+    void clear(){
+        hits_.clear();
+    }
+    //hits需要按偏移升序加入，同一个词的命中本身有序时可以用merge_hits把它和前面的命中归并
+    void add_hit(uint32_t offset,uint32_t len,uint32_t word){
+        hits_.push_back(snippet_hit{offset,len,word});
+    }
+    //把从middle开始追加的一段有序命中和前面的命中归并
+    void merge_hits(size_t middle){
+        std::inplace_merge(hits_.begin(),hits_.begin()+middle,hits_.end(),[](const snippet_hit& a,const snippet_hit& b){
+            return a.offset!=b.offset?a.offset<b.offset:a.len>b.len;
+        });
+    }
+    size_t hit_count() const {
+        return hits_.size();
+    }
+    //没有位置信息时扫描整篇正文找出所有命中
+    void scan(std::string_view content){
+        if(!matcher_ready_){
+            matcher_.build(words_);
+            matcher_ready_ = true;
+        }
+        matcher_.find_all(content,&hits_);
+    }
+
+    //选出包含不同查询词最多的一段，往前取before字节、往后取after字节，高亮其中的命中，没有命中时取开头
+    //摘要直接转义成json字符串（带引号）追加到out，不生成中间的字符串
+    void render(std::string_view content,size_t before,size_t after,std::string* out){
+        out->push_back('"');
+        if(hits_.empty()){
+            size_t end = utf8_end(content,std::min(content.size(),before+after));
+            append_json_escaped(content.substr(0,end),out);
+            out->append("...\"");
+            return;
+        }
+        //滑动窗口：窗口从hits_[left]开始，包含结束位置不超过 起点+after 的所有命中
+        counts_.assign(words_.size(),0);
+        size_t best = 0,best_total = 0,right = 0;
+        int best_distinct = 0,distinct = 0;
+        for(size_t left = 0;left<hits_.size();left++){
+            size_t limit = (size_t)hits_[left].offset+hits_[left].len+after;
+            while(right<hits_.size()&&(right<=left||hits_[right].offset+hits_[right].len<=limit)){
+                if(counts_[hits_[right].word]++ == 0) distinct++;
+                right++;
+            }
+            if(distinct>best_distinct||(distinct == best_distinct&&right-left>best_total)){
+                best_distinct = distinct;
+                best_total = right-left;
+                best = left;
+            }
+            if(--counts_[hits_[left].word] == 0) distinct--;
+        }
+        size_t start = hits_[best].offset>before?hits_[best].offset-before:0;
+        size_t end = std::min(content.size(),(size_t)hits_[best].offset+hits_[best].len+after);
+        while(start>0&&((uint8_t)content[start]&0xC0) == 0x80) start--;
+        end = utf8_end(content,end);
+
+        out->append("...");
+        size_t cursor = start;
+        for(const snippet_hit& hit:hits_){
+            if(hit.offset<cursor||hit.offset+hit.len>end){
+                continue;//在窗口之外，或者和前一个高亮的词重叠
+            }
+            append_json_escaped(content.substr(cursor,hit.offset-cursor),out);
+            out->append("<em>");
+            append_json_escaped(content.substr(hit.offset,hit.len),out);
+            out->append("</em>");
+            cursor = hit.offset+hit.len;
+        }
+        append_json_escaped(content.substr(cursor,end-cursor),out);
+        out->append("...\"");
+    }
+private:
+    //把结束位置往后挪到UTF-8字符边界
+    static size_t utf8_end(std::string_view content,size_t end){
+        while(end<content.size()&&((uint8_t)content[end]&0xC0) == 0x80) end++;
+        return end;
+    }
+private:
+    std::vector<std::string> words_;
+    term_matcher matcher_;
+    bool matcher_ready_ = false;
+    std::vector<snippet_hit> hits_;
+    std::vector<int> counts_;
+};
@@ -1,16 +1,90 @@
+#include <signal.h>
+#include <pthread.h>
+#include <fstream>
+#include <iterator>
+#include <jsoncpp/json/json.h>
 #include "cpp-httplib/httplib.h"
 #include "searcher.hpp"
 #include "Log.hpp"
 
 const std::string input = "data/raw_html/raw.txt";
+const std::string index_path = "data/raw_html/index.bin";
+const std::string delta_path = "data/raw_html/delta.txt";//parser -i 产生的变更日志
+const std::string parser_metrics_path = "data/raw_html/parser_metrics.prom";//parser最近一次运行的耗时统计
 const std::string root_path = "./wwwroot";
+const size_t cache_capacity = 64<<20;//查询结果缓存的内存上限，64MB
 
-int main()
+//读取非负整数参数，参数不存在或不合法时返回默认值
+size_t get_size_param(const httplib::Request& req,const std::string& key,size_t default_value)
+{
+    if(!req.has_param(key)) return default_value;
+    std::string value = req.get_param_value(key);
+    if(value.empty()||value.size()>9||value.find_first_not_of("0123456789")!=std::string::npos){
+        return default_value;
+    }
+    return std::stoul(value);
+}
+
+//把线程自己的缓冲区作为响应正文，httplib在当前线程写完这个响应之后才会处理下一个请求，
+//缓冲区在这之前不会被改写，不需要再拷贝一份到res.body
+void set_json_content(httplib::Response& res,const std::string* body)
+{
+    res.set_content_provider(body->size(),"application/json; charset=utf-8",[body](size_t offset,size_t length,httplib::DataSink& sink){
+        return sink.write(body->data()+offset,length);
+    });
+}
+
+//在后台线程中重新加载索引，加载完成后替换正在使用的索引，期间查询照常进行
+//已经有一次加载在进行时不再重复启动，返回false
+bool start_reload(Searcher& searcher)
+{
+    static std::atomic<bool> reloading{false};
+    if(reloading.exchange(true)){
+        return false;
+    }
+    std::thread([&searcher]{
+        LOG(INFO,"开始重新加载索引");
+        searcher.reload_index();
+        reloading = false;
+    }).detach();
+    return true;
+}
+
+//用法：./http_server [工作线程数]，不指定时读环境变量SEARCH_THREADS，都没有时按CPU核数
+int main(int argc,char* argv[])
 {
     able_save();
+    if(getenv("LOG_LEVEL") == nullptr){
+        set_log_level(INFO);//服务默认不记录建索引时逐个文档的调试日志
+    }
+    //SIGHUP触发重新加载索引：先在主线程屏蔽，之后创建的线程都继承这个屏蔽字，由专门的线程sigwait等待
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup,SIGHUP);
+    pthread_sigmask(SIG_BLOCK,&hup,nullptr);
+    size_t thread_num = 0;
+    if(argc>1){
+        thread_num = std::strtoul(argv[1],nullptr,10);
+    }else if(getenv("SEARCH_THREADS")){
+        thread_num = std::strtoul(getenv("SEARCH_THREADS"),nullptr,10);
+    }
+    if(thread_num == 0){
+        thread_num = std::max(1u,std::thread::hardware_concurrency());
+    }
     Searcher searcher;
-    searcher.init_search(input);
+    searcher.init_search(input,index_path,true,delta_path);//以mmap只读方式加载快照，再应用变更日志
+    searcher.set_cache_capacity(cache_capacity);
+    std::thread([&searcher,hup]{
+        int sig;
+        while(sigwait(&hup,&sig) == 0){
+            start_reload(searcher);
+        }
+    }).detach();
     httplib::Server svr;
+    //处理请求的线程池，每个线程都可以独立地调用searcher.search
+    svr.new_task_queue = [thread_num]{ return new httplib::ThreadPool(thread_num); };
+    //响应的头和正文是分两次写的，不关Nagle的话每个keep-alive请求都会被延迟确认卡住几十毫秒
+    svr.set_tcp_nodelay(true);
     svr.set_base_dir(root_path.c_str());//添加主网页
     svr.Get("/s",[&searcher](const httplib::Request& req, httplib::Response& res) {
         if(!req.has_param("query"))
@@ -19,12 +93,85 @@ int main()
             return;
         }
         std::string query = req.get_param_value("query");
+        //分页参数，start为结果的起始位置，count为本页的结果数
+        size_t start = get_size_param(req,"start",0);
+        size_t count = get_size_param(req,"count",DEFAULT_PAGE_SIZE);
+        if(count == 0||count>MAX_PAGE_SIZE) count = DEFAULT_PAGE_SIZE;
         LOG(INFO,"query:%s",query.c_str());
-        std::string json_string;    
-        searcher.search(query,json_string);
-        res.set_content(json_string,"application/json; charset=utf-8");
+        static thread_local std::string json_string;
+        searcher.search(query,json_string,start,count);
+        set_json_content(res,&json_string);
+    });
+    //输入联想，前端每次输入都会请求，不记日志
+    svr.Get("/suggest",[&searcher](const httplib::Request& req, httplib::Response& res) {
+        static thread_local std::string json_string;
+        size_t count = get_size_param(req,"count",SUGGEST_TOP_K);
+        searcher.suggest(req.get_param_value("prefix"),json_string,count);
+        set_json_content(res,&json_string);
+    });
+    //应用parser -i 新追加的变更，不需要重启服务，只允许本机调用
+    svr.Get("/admin/update",[&searcher](const httplib::Request& req, httplib::Response& res) {
+        if(req.remote_addr!="127.0.0.1"&&req.remote_addr!="::1"){
+            res.status = 403;
+            return;
+        }
+        int count = searcher.update_index(delta_path);
+        LOG(INFO,"应用变更%d条",count);
+        Json::Value root;
+        root["applied"] = count;
+        Json::FastWriter write;
+        res.set_content(write.write(root),"application/json; charset=utf-8");
+    });
+    //重新构建快照后（build_index）热替换索引，和kill -HUP效果相同，只允许本机调用
+    svr.Get("/admin/reload",[&searcher](const httplib::Request& req, httplib::Response& res) {
+        if(req.remote_addr!="127.0.0.1"&&req.remote_addr!="::1"){
+            res.status = 403;
+            return;
+        }
+        Json::Value root;
+        root["started"] = start_reload(searcher);
+        Json::FastWriter write;
+        res.set_content(write.write(root),"application/json; charset=utf-8");
+    });
+    //查询结果缓存和正文解压块缓存的命中统计
+    svr.Get("/cache_stats",[&searcher](const httplib::Request&, httplib::Response& res) {
+        cache_stats stats = searcher.get_cache_stats();
+        uint64_t total = stats.hits+stats.misses;
+        Json::Value root;
+        root["hits"] = (Json::UInt64)stats.hits;
+        root["misses"] = (Json::UInt64)stats.misses;
+        root["hit_rate"] = total == 0?0.0:(double)stats.hits/total;
+        root["inserts"] = (Json::UInt64)stats.inserts;
+        root["evictions"] = (Json::UInt64)stats.evictions;
+        root["entries"] = (Json::UInt64)stats.entries;
+        root["bytes"] = (Json::UInt64)stats.bytes;
+        root["capacity"] = (Json::UInt64)stats.capacity;
+        //正文解压块缓存
+        cache_stats content = searcher.get_content_cache_stats();
+        uint64_t content_total = content.hits+content.misses;
+        Json::Value blocks;
+        blocks["hits"] = (Json::UInt64)content.hits;
+        blocks["misses"] = (Json::UInt64)content.misses;
+        blocks["hit_rate"] = content_total == 0?0.0:(double)content.hits/content_total;
+        blocks["evictions"] = (Json::UInt64)content.evictions;
+        blocks["entries"] = (Json::UInt64)content.entries;
+        blocks["bytes"] = (Json::UInt64)content.bytes;
+        blocks["capacity"] = (Json::UInt64)content.capacity;
+        root["content_blocks"] = blocks;
+        Json::FastWriter write;
+        res.set_content(write.write(root),"application/json; charset=utf-8");
+    });
+    //Prometheus文本格式的监控指标：查询各阶段耗时、索引规模、缓存、建索引耗时，再附上parser最近一次运行的统计
+    svr.Get("/metrics",[&searcher](const httplib::Request&, httplib::Response& res) {
+        std::string text;
+        searcher.write_metrics(&text);
+        std::ifstream ifm(parser_metrics_path,std::ios::in|std::ios::binary);
+        if(ifm.is_open()){
+            text.append(std::istreambuf_iterator<char>(ifm),std::istreambuf_iterator<char>());
+        }
+        res.set_content(std::move(text),"text/plain; version=0.0.4; charset=utf-8");
     });
-    LOG(INFO,"start server");
+    LOG(INFO,"start server, %d个工作线程",(int)thread_num);
     svr.listen("0.0.0.0", 8080);
     return 0;
 }
@@ -4,8 +4,8 @@
 yui的boost搜索引擎，索引篇
 在parser.cc文件中，已经把boost官方库的索引html内容提取并排列出来了 位于./data/raw_html/raw.txt
 索引篇的目标：建立正排索引和倒排索引
-建立索引类（单例模式，防止重复建立索引）：
-属性：利用数组存储的正排索引、利用哈希表存储的倒排索引、静态的索引指针、静态的共享锁
+建立索引类（单例模式，防止重复建立索引；服务热替换索引时新旧两份索引需要同时存在，也可以直接构造）：
+属性：利用数组存储的正排索引、利用词典（lexicon.hpp）存储的倒排索引、静态的索引指针、静态的共享锁
 正排索引，id -> 内容。利用数组下标充当id，内容为html的title content url （构建结构体）
 倒排索引，内容 -> id。 一个内容可以指向多个id(有点类似于邻接表的结构)。
 为了实现这个结构 哈希表的key为内容，value为对应id的数组 值得一提的是数组中存储不是单纯的id，而是对应id中该内容及该内容的权重 所以还要构造一个结构体。
@@ -18,18 +18,123 @@ private：建立正排索引、建立倒排索引
 建立索引：读取raw.txt文件，然后建立正排索引、倒排索引
 建立正排索引：根据输入的一行内容，提取出 title content url 构建id 返回结构体doc
 构建倒排索引：对doc进行词频统计（tiitl content）在统计前要进行分词 分完词开始计算权重
+权重用BM25F计算（见bm25.hpp），需要文档数、各字段的平均长度和词的文档频率，所以分词时只记下词频和文档长度，
+全部文档处理完之后压缩倒排拉链时再算出每个倒排元素的权重和每个词的idf
 
+索引快照：
+每次启动都从raw.txt重新分词建索引太慢，所以索引建好后可以整体写成一个二进制快照文件，
+下次启动时直接读入快照即可，耗时基本等于读文件的时间。
+快照格式（所有整数为本机字节序）：
+[index_header][doc_entry * doc_count][doc_block * doc_block_count][term_entry * term_count][lexicon_slot * slot_count]
+[posting_block * block_count][uint32_t * block_count][倒排数据区][位置数据区][词典字符串区][正文压缩数据区][字符串区]
+- doc_entry：正排索引，记录title/url在字符串区中的偏移和长度，以及正文在压缩块中的位置，下标即为文档id
+- doc_block/正文压缩数据区：按块压缩的正文（见docstore.hpp），读取时解压整块
+- term_entry/lexicon_slot/词典字符串区：词典（见lexicon.hpp），词典项按字词字典序排列，记录字词在词典字符串区中的位置
+  以及它的压缩倒排拉链的位置，哈希槽用于按词查找，mmap之后直接使用
+- posting_block/倒排数据区：压缩后的倒排拉链（见postings.hpp），同一个词的块和数据都是连续存放的
+- uint32_t数组/位置数据区：可选的位置信息（见postings.hpp），数组和posting_block一一对应，没有保存位置时位置数据区为空
+格式有变化时需要增加INDEX_VERSION，旧版本的快照会被拒绝加载
+版本2：倒排拉链改为分块的delta+varint压缩格式，权重量化为1个字节
+版本3：块表和词典中增加最大权重，用于WAND/Block-Max WAND剪枝
+版本4：增加位置信息，用于短语查询、邻近度加分和生成摘要
+版本5：权重改为BM25F，词典中增加idf，文件头中增加各字段的总词数
+版本6：词典增加哈希槽，字词的字符串单独存放在词典字符串区
+版本7：正文按块压缩，单独存放在正文压缩数据区，字符串区只有标题和url
 
+倒排索引在建索引的过程中先按词收集(id,词频)，全部文档处理完之后再统一压缩（freeze_index），
+压缩后所有词的块表和数据各自放在一个连续的数组里，词典里只保存每个词的位置信息。
+建索引时默认同时记录每个词在文档中出现的位置（set_store_positions(false)可以关闭），和倒排拉链分开存放，
+不需要位置的查询不会多读任何数据。
+
+快照有两种加载方式：
+- load_index：把快照读进堆内存（正文仍然是压缩的，只拷贝压缩数据）
+- map_index：只读地mmap整个快照文件，正排/倒排索引都直接返回指向映射区的视图，不做任何拷贝。
+  同一台机器上的多个服务进程共享同一份page cache，进程的内存占用基本就是快照文件本身的大小
+
+增量更新：
+文档更新时不需要重建整个索引。parser -i 只解析新增/修改/删除的html，把变更追加到变更日志(delta.txt)：
+  A\3title\3content\3url  新增文档      U\3title\3content\3url  修改文档      D\3url  删除文档
+apply_delta读取上次应用之后追加的变更，把新增/修改的文档建成一个小的增量段(index_segment)，
+文档id接着已有的最大id往后分配；修改和删除的旧文档按url找到id后打上删除标记（tombstone），查询时跳过
+基础索引（快照或者全量建立的索引）本身不会被修改，所有增量段和删除标记放在一个segment_set里，
+每次更新都生成一个新的segment_set，用原子操作整体替换（类似RCU），查询线程拿到的视图在查询期间不会变化
+增量段太多时后台线程把它们合并成一个段，顺便丢掉已删除文档的倒排元素和正文
+增量段只在内存中，服务重启时加载快照后重新应用整个变更日志；用raw.txt重建索引后变更日志会被清空
 */
 
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <string_view>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "Log.hpp"
 #include "tools.hpp"
+#include "postings.hpp"
+#include "bm25.hpp"
+#include "lexicon.hpp"
+#include "suggest.hpp"
+#include "docstore.hpp"
+#include "metrics.hpp"
+
+//快照文件的魔数与版本号
+const char INDEX_MAGIC[8] = {'Y','U','I','I','D','X','\0','\0'};
+const uint32_t INDEX_VERSION = 7;
+
+//快照文件头
+struct index_header{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t doc_count;
+    uint64_t term_count;
+    uint64_t slot_count;     // 词典哈希槽的个数
+    uint64_t posting_count;  // 倒排元素总数
+    uint64_t title_tokens;   // 所有文档标题的总词数，和doc_count一起算出平均长度，给增量段打分用
+    uint64_t content_tokens; // 所有文档正文的总词数
+    uint64_t block_count;
+    uint64_t doc_offset;     // doc_entry数组的起始位置
+    uint64_t term_offset;    // term_entry数组的起始位置
+    uint64_t slot_offset;    // lexicon_slot数组的起始位置
+    uint64_t block_offset;   // posting_block数组的起始位置
+    uint64_t posting_offset; // 倒排数据区的起始位置
+    uint64_t posting_size;
+    uint64_t position_block_offset; // 位置块表（uint32_t * block_count）的起始位置
+    uint64_t position_offset;       // 位置数据区的起始位置
+    uint64_t position_size;
+    uint64_t term_string_offset; // 词典字符串区的起始位置
+    uint64_t term_string_size;
+    uint64_t doc_block_count;  // 正文压缩块的个数
+    uint64_t doc_block_offset; // doc_block数组的起始位置
+    uint64_t doc_data_offset;  // 正文压缩数据区的起始位置
+    uint64_t doc_data_size;
+    uint64_t string_offset;  // 字符串区的起始位置
+    uint64_t string_size;
+    uint64_t file_size;
+};
+
+//正排索引项，title/url的偏移是相对字符串区起始位置，正文在第content_block个压缩块解压后的content_offset处
+struct doc_entry{
+    uint64_t title_offset;
+    uint64_t content_offset;
+    uint64_t url_offset;
+    uint32_t title_size;
+    uint32_t content_size;
+    uint32_t url_size;
+    uint32_t content_block;
+};
 
 class Doc{
 public:
@@ -47,82 +152,390 @@ public:
     uint64_t id_;
 };
 
+//文档的只读视图，标题和url指向Doc里的字符串或者mmap的快照，生命周期跟随Index
+//正文指向解压后的块时由content_block_持有这一块，content_在DocView（或者它的拷贝）释放之前有效
+class DocView{
+public:
+    DocView(){}
+    DocView(std::string_view title,std::string_view content,std::string_view url,uint64_t id)
+    :title_(title)
+    ,content_(content)
+    ,url_(url)
+    ,id_(id)
+    {}
+public:
+    std::string_view title_;
+    std::string_view content_;
+    std::string_view url_;
+    uint64_t id_ = 0;
+    std::shared_ptr<const std::string> content_block_;
+};
+
+//建索引时使用的倒排元素，不保存字词本身（字词就是倒排索引的key，每个元素都拷贝一份太浪费内存）
+//建完索引后会被压缩成posting_block+数据区的形式
+//分词时只有词频tf_，压缩前才根据文档长度算出weight_；合并增量段时直接带着算好的weight_
+//positions_为编码后的位置信息（encode_doc_positions），不记录位置时为空，大多数都很短，不会额外申请内存
 class Inverted_item{
 public:
     Inverted_item(){}
-    Inverted_item(uint64_t id,std::string word,int weight = 0)
+    Inverted_item(uint64_t id,int weight = 0,std::string positions = "")
     :id_(id)
-    ,word_(word)
     ,weight_(weight)
+    ,positions_(std::move(positions))
+    {}
+    Inverted_item(uint64_t id,const term_freq& tf,std::string positions)
+    :id_(id)
+    ,tf_(tf)
+    ,positions_(std::move(positions))
     {}
 public:
-    uint64_t id_;
-    std::string word_;
-    int weight_;
+    uint64_t id_ = 0;
+    int weight_ = 0;
+    term_freq tf_;
+    std::string positions_;
 };
 
 using inverted_list = std::vector<Inverted_item>;
 
-class Index{
+//建索引过程中未压缩的倒排索引：词由term_interner分配id，倒排拉链按id连续存放
+//每个词只在第一次出现时保存一次字符串，之后的查找只比较哈希槽里的指纹，不为每个词申请哈希表节点
+struct building_postings{
+    term_interner terms;
+    std::vector<inverted_list> lists;//下标为词id
+
+    //word的倒排拉链，没有时新建一个空的；h为lexicon_hash(word)
+    inverted_list& get(std::string_view word,uint64_t h){
+        uint32_t id = terms.intern(word,h);
+        if(id == lists.size()){
+            lists.emplace_back();
+        }
+        return lists[id];
+    }
+    inverted_list& get(std::string_view word){
+        return get(word,lexicon_hash(word));
+    }
+    size_t size() const {
+        return lists.size();
+    }
+};
+
+//增量段：一次增量更新新增的文档及其倒排索引，建好后只读
+//段内文档的id为[base_id,base_id+docs.size())，合并后被删除的文档只保留空的正排项
+struct index_segment{
+    uint64_t base_id = 0;
+    std::vector<Doc> docs;
+    lexicon terms;
+    std::vector<posting_block> blocks;
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> position_blocks;
+    std::vector<uint8_t> position_data;
+
+    uint64_t end_id() const {
+        return base_id+docs.size();
+    }
+    bool get_inverted_index(std::string_view word,posting_list_view* list) const {
+        const posting_meta* meta = terms.find(word);
+        if(meta == nullptr){
+            return false;
+        }
+        *list = make_posting_view(*meta,blocks.data(),data.data(),position_blocks.data(),position_data.data());
+        return true;
+    }
+};
+
+//某一时刻的全部增量段和删除标记，发布后只读，更新时整体替换
+struct segment_set{
+    std::vector<std::shared_ptr<const index_segment>> segments;//按base_id升序
+    std::vector<uint64_t> deleted;//删除标记位图，下标为文档id
+    uint64_t deleted_count = 0;
+    uint64_t generation = 0;//索引内容的版本号，进程内唯一，结果缓存用它区分不同版本的结果
+
+    bool is_deleted(uint64_t id) const {
+        return id/64<deleted.size()&&(deleted[id/64]>>(id%64)&1);
+    }
+    void mark_deleted(uint64_t id){
+        if(id/64>=deleted.size()){
+            deleted.resize(id/64+1,0);
+        }
+        if(!is_deleted(id)){
+            deleted[id/64]|=1ull<<(id%64);
+            deleted_count++;
+        }
+    }
+};
+
+//create_index各阶段的耗时（纳秒），/metrics输出，建完索引时也会打一行日志
+//读取和分词是流水线并行的：read为主线程读完raw.txt的时间，tokenize为之后等分词线程全部结束的时间
+struct index_build_stats{
+    latency_histogram tokenize_doc;//每个文档分词、统计词频的耗时
+    uint64_t read_ns = 0;
+    uint64_t tokenize_ns = 0;
+    uint64_t content_ns = 0;//压缩正文
+    uint64_t merge_ns = 0;//合并各分词线程的倒排拉链、打分、压缩
+    uint64_t dictionary_ns = 0;//拼接分片、建立词典
+    uint64_t total_ns = 0;
+};
+
+//索引的规模，/metrics输出用
+struct index_size_stats{
+    uint64_t docs = 0;//基础索引的文档数
+    uint64_t terms = 0;
+    uint64_t postings = 0;
+    uint64_t posting_bytes = 0;//块表+压缩数据
+    uint64_t position_bytes = 0;
+    uint64_t content_bytes = 0;//压缩后的正文
+    uint64_t content_raw_bytes = 0;
+    uint64_t snapshot_bytes = 0;//mmap的快照大小，堆内存模式下为0
+    uint64_t segments = 0;
+    uint64_t segment_docs = 0;
+    uint64_t deleted_docs = 0;
+};
+
+//进程内唯一的索引版本号，每次替换基础索引或者应用变更都取一个新的
+inline uint64_t next_index_generation(){
+    static std::atomic<uint64_t> generation{0};
+    return ++generation;
+}
+
+class Index : public std::enable_shared_from_this<Index>{
 private:
-    std::vector<Doc> forward_index; // 正排索引
-    std::unordered_map<std::string,inverted_list> inverted_index; // 倒排索引
+    std::vector<Doc> forward_index; // 正排索引，正文压缩之后Doc里的content_为空
+    doc_store contents; // 按块压缩的正文，mmap模式下指向快照
+    std::vector<content_ref> content_refs; // 堆内存模式下每个文档的正文在contents中的位置，下标为id
+    building_postings building_index; // 建索引过程中未压缩的倒排索引
+    lexicon dictionary; // 倒排索引的词典，字词 -> 压缩倒排拉链的位置，mmap模式下指向快照
+    suggester suggestions; // 输入联想用的前缀树，建立在dictionary上，需要时调用build_suggestions建立
+    std::vector<posting_block> posting_blocks; // 所有词的块表
+    std::vector<uint8_t> posting_data; // 所有词的压缩数据
+    std::vector<uint32_t> position_blocks; // 位置块表，和posting_blocks一一对应
+    std::vector<uint8_t> position_data; // 所有词的位置信息
+    uint64_t posting_count = 0;
+    bool store_positions = true;//建索引时是否记录位置信息
+    bm25_stats stats;//基础索引的文档数和各字段总词数
+    std::vector<doc_length> building_lengths;//create_inverted_index记下的文档长度，下标为id
+    index_build_stats build_stats;//最近一次create_index的耗时
+
+    //mmap模式下的快照，mapped_base为nullptr时表示使用上面的堆内存索引
+    const char* mapped_base = nullptr;
+    size_t mapped_size = 0;
+    index_header mapped_header;
+    const doc_entry* mapped_docs = nullptr;
+    const posting_block* mapped_blocks = nullptr;
+    const uint8_t* mapped_postings = nullptr;
+    const uint32_t* mapped_position_blocks = nullptr;
+    const uint8_t* mapped_positions = nullptr;
+    const char* mapped_strings = nullptr;
+
+    //增量更新，segments用std::atomic_load/std::atomic_store读写
+    std::shared_ptr<const segment_set> segments = std::make_shared<segment_set>();
+    std::mutex update_mtx;//同一时间只允许一个线程应用变更或者替换合并结果
+    std::unordered_map<std::string,uint64_t> url_ids;//url -> 当前有效的文档id，只在update_mtx下使用
+    bool url_ids_ready = false;
+    uint64_t delta_offset = 0;//变更日志中已经应用到的位置
+    std::atomic<bool> merging{false};
 public:
-    
-private:
     Index(){}
     Index(const Index&) = delete;
     Index& operator=(const Index&) = delete;
-public:
-    ~Index(){}
+    ~Index(){
+        unmap_index();
+    }
     static Index* get_instance(){
-        if(instance == nullptr){
-            mtx.lock();
-            if(instance == nullptr){
-                instance = new Index();
+        Index* tmp = instance.load(std::memory_order_acquire);
+        if(tmp == nullptr){
+            std::lock_guard<std::mutex> lock(mtx);
+            tmp = instance.load(std::memory_order_relaxed);
+            if(tmp == nullptr){
+                tmp = new Index();
+                instance.store(tmp,std::memory_order_release);
             }
-            mtx.unlock();
         }
-        return instance;
+        return tmp;
+    }
+    //建索引和应用变更时是否记录位置信息，需要在create_index之前设置
+    void set_store_positions(bool enable){
+        store_positions = enable;
     }
-    bool create_index(const std::string input){
+
+    //建索引时每批交给分词线程的文档数
+    static const size_t BUILD_BATCH_SIZE = 64;
+    //增量段超过这个数量时在后台合并
+    static const size_t MAX_DELTA_SEGMENTS = 4;
+
+    bool create_index(const std::string input,int thread_num = 0){
         //创建索引
         /**
         input为raw.txt文件的路径
         后续按行读取
         读取成功数据后，将读取成功的数据先建立正排索引然后再建立倒排索引
+
+        分词是建索引最耗时的部分，所以建索引是一个多线程的流水线：
+        1.读取线程（当前线程）：按行读取raw.txt，切分出title content url并按顺序分配id，
+          每BUILD_BATCH_SIZE个文档打成一批放进队列
+        2.分词线程（thread_num个）：从队列中取出一批文档，分词、统计词频、计算权重，
+          结果放进线程自己的局部倒排索引，局部倒排索引按字词的哈希分成thread_num个分片
+        3.合并线程（thread_num个）：第i个线程把所有分词线程的第i个分片合并起来，按id排序后压缩
+        最后把各分片压缩好的倒排拉链拼到一起。每个词的倒排拉链只取决于文档内容和id，
+        与线程数、线程调度顺序都无关，所以结果是确定的
+        thread_num<=0时使用机器的核数
+        只能在空的Index上调用（新构造的，没有加载过快照也没有建过索引），否则返回false：
+        文档id、词典和打分的统计量都是从头建立的，不支持往已有的索引里追加
          */
+        if(doc_count()!=0||dictionary.size()!=0){
+            LOG(Level::ERROR,"create_index只能在空的索引上调用");
+            return false;
+        }
         std::ifstream ifm(input,std::ios::in);
         if(!ifm.is_open()){
             // LOG(FATAL,"%s文件打开失败",input.c_str());
             // LOG(FATAL,"111");
             return false;
         }
+        if(thread_num<=0){
+            thread_num = std::max(1u,std::thread::hardware_concurrency());
+        }
+        //分词线程启动前先初始化分词单例，之后各线程只读地使用它
+        JiebaUtil::get_instance();
+        reset_segments();
+        stopwatch build_timer;
+
+        using doc_batch = std::vector<Doc>;
+        using shard_list = std::vector<building_postings>;
+        block_queue<std::shared_ptr<doc_batch>> queue(thread_num*4);
+        std::vector<shard_list> worker_shards(thread_num,shard_list(thread_num));
+        std::vector<std::vector<std::pair<uint64_t,doc_length>>> worker_lengths(thread_num);
+        std::vector<std::thread> workers;
+        bool with_positions = store_positions;
+        latency_histogram& tokenize_doc = build_stats.tokenize_doc;
+        for(int t = 0;t<thread_num;t++){
+            workers.emplace_back([&queue,&worker_shards,&worker_lengths,&tokenize_doc,thread_num,with_positions,t]{
+                shard_list& shards = worker_shards[t];
+                std::shared_ptr<doc_batch> batch;
+                stopwatch doc_timer;
+                while(queue.pop(&batch)){
+                    for(const Doc& doc:*batch){
+                        doc_timer.lap();
+                        doc_length length = count_words(doc,with_positions,[&](std::string_view word,const term_freq& tf,std::string& positions){
+                            //按词的哈希分片，同一个哈希值在分片内查找时接着用
+                            uint64_t h = lexicon_hash(word);
+                            shards[h%thread_num].get(word,h).emplace_back(doc.id_,tf,std::move(positions));
+                        });
+                        worker_lengths[t].emplace_back(doc.id_,length);
+                        tokenize_doc.record(doc_timer.lap());
+                    }
+                }
+            });
+        }
+
         //开始读取数据
+        std::vector<std::shared_ptr<doc_batch>> batches;//按读取顺序保存，最后依次移入正排索引
+        std::shared_ptr<doc_batch> batch = std::make_shared<doc_batch>();
         std::string data_line;
+        uint64_t first_id = forward_index.size();
+        uint64_t id = first_id;
         int count = 0;
         while(std::getline(ifm,data_line)){
-            //读取一行数据后开始建立正排索引，同时接收返回值
-            // Doc* doc_item = create_forward_index(data_line);
-            // if(nullptr == doc_item){
-            //     // LOG(WARNING,"正排索引创建失败");
-            //     continue;
-            // }
-            if(create_forward_index(data_line) == false){
+            //读取一行数据后开始建立正排索引
+            Doc doc;
+            if(!parse_doc(data_line,id,&doc)){
                 LOG(Level::WARNING,"正排索引创建失败");
                 continue;
             }
-            Doc* doc_item = &forward_index.back();
-            //根据建立正排索引的返回值，开始建立倒排索引
-            create_inverted_index(*doc_item);//传递的地址
-            // if(count++<100){
-                LOG(Level::DEBUG,"建立索引成功%d",++count);
-            // }
+            batch->push_back(std::move(doc));
+            id++;
+            LOG(Level::DEBUG,"建立索引成功%d",++count);
+            if(batch->size()>=BUILD_BATCH_SIZE){
+                batches.push_back(batch);
+                queue.push(batch);
+                batch = std::make_shared<doc_batch>();
+            }
+        }
+        if(!batch->empty()){
+            batches.push_back(batch);
+            queue.push(batch);
+        }
+        queue.close();
+        build_stats.read_ns = build_timer.lap();
+        for(std::thread& worker:workers){
+            worker.join();
+        }
+        build_stats.tokenize_ns = build_timer.lap();
+        forward_index.reserve(forward_index.size()+count);
+        for(auto& item:batches){
+            for(Doc& doc:*item){
+                forward_index.push_back(std::move(doc));
+            }
+        }
+        std::vector<std::shared_ptr<doc_batch>>().swap(batches);
+        if(!compress_contents(first_id,thread_num)){
+            return false;
+        }
+        build_stats.content_ns = build_timer.lap();
+        //所有文档的长度都有了，才能算平均长度和idf
+        stats = bm25_stats();
+        std::vector<doc_length> lengths(id-first_id);
+        for(auto& item:worker_lengths){
+            for(auto& length:item){
+                lengths[length.first-first_id] = length.second;
+                stats.add(length.second);
+            }
+            std::vector<std::pair<uint64_t,doc_length>>().swap(item);
         }
+        scoring_context scoring;
+        scoring.stats = stats;
+        scoring.doc_count = stats.doc_count;
+        scoring.lengths = lengths.data();
+        scoring.base_id = first_id;
+
+        //按分片并行合并、打分、压缩
+        std::vector<frozen_shard> frozen(thread_num);
+        std::vector<std::thread> mergers;
+        for(int t = 0;t<thread_num;t++){
+            mergers.emplace_back([&worker_shards,&frozen,&scoring,thread_num,t]{
+                building_postings shard;
+                for(int w = 0;w<thread_num;w++){
+                    building_postings& part = worker_shards[w][t];
+                    for(uint32_t id = 0;id<part.size();id++){
+                        inverted_list& list = shard.get(part.terms.word(id),part.terms.hash(id));
+                        list.insert(list.end(),std::make_move_iterator(part.lists[id].begin()),std::make_move_iterator(part.lists[id].end()));
+                    }
+                    part = building_postings();
+                }
+                freeze_shard(shard,scoring,&frozen[t]);
+            });
+        }
+        for(std::thread& merger:mergers){
+            merger.join();
+        }
+        build_stats.merge_ns = build_timer.lap();
+        append_frozen(frozen);
+        posting_blocks.shrink_to_fit();
+        posting_data.shrink_to_fit();
+        position_blocks.shrink_to_fit();
+        position_data.shrink_to_fit();
+        build_stats.dictionary_ns = build_timer.lap();
+        build_stats.total_ns = build_stats.read_ns+build_stats.tokenize_ns+build_stats.content_ns+build_stats.merge_ns+build_stats.dictionary_ns;
+        LOG(Level::INFO,"建索引耗时%.2fs：读取%.2fs，等待分词%.2fs，压缩正文%.2fs，合并倒排%.2fs，建立词典%.2fs；单个文档分词p50 %.1fus，p99 %.1fus，最长%.1fms",
+            build_stats.total_ns/1e9,build_stats.read_ns/1e9,build_stats.tokenize_ns/1e9,build_stats.content_ns/1e9,
+            build_stats.merge_ns/1e9,build_stats.dictionary_ns/1e9,tokenize_doc.quantile(0.5)/1e3,tokenize_doc.quantile(0.99)/1e3,tokenize_doc.max()/1e6);
+        LOG(Level::INFO,"%d个线程建立索引完成，文档数%d，倒排元素%llu个，压缩后%llu字节，位置信息%llu字节",thread_num,count,
+            (unsigned long long)posting_count,
+            (unsigned long long)(posting_blocks.size()*sizeof(posting_block)+posting_data.size()),
+            (unsigned long long)(position_blocks.size()*sizeof(uint32_t)+position_data.size()));
         return true;
     }
 
     bool create_forward_index(std::string&data_line){
+        Doc tmp;
+        if(!parse_doc(data_line,forward_index.size(),&tmp)){
+            return false;
+        }
+        forward_index.push_back(std::move(tmp));
+        return true;
+    }
+
+    //解析raw.txt中的一行，得到id为id的文档
+    static bool parse_doc(std::string&data_line,uint64_t id,Doc* doc){
         //一个文件内的数据在raw.txt只占有一行，不同属性间的分隔符为'\3'
         //利用boost库中的split函数可以快速得到被分隔符分开后的内容
         std::vector<std::string> res;
@@ -132,72 +545,985 @@ public:
             return false;
         }
         //切割成功
-        Doc tmp(res[0],res[1],res[2],forward_index.size()); // 定义一个临时的Doc变量，后续可以直接右值move
-        forward_index.push_back(std::move(tmp));
+        doc->title_ = std::move(res[0]);
+        doc->content_ = std::move(res[1]);
+        doc->url_ = std::move(res[2]);
+        doc->id_ = id;
         return true;
     }
 
     void create_inverted_index(const Doc& doc){
+        doc_length length = count_words(doc,store_positions,[&](std::string_view word,const term_freq& tf,std::string& positions){
+            building_index.get(word).emplace_back(doc.id_,tf,std::move(positions));
+        });
+        if(building_lengths.size()<=doc.id_){
+            building_lengths.resize(doc.id_+1);
+        }
+        building_lengths[doc.id_] = length;
+    }
+
+    //对文档分词并统计词频，每个词调用一次emit(word,tf,positions)，返回各字段的长度（词数）
+    //word指向线程自己的分词结果，只在emit调用期间有效，需要保存时由emit自己拷贝（intern）
+    //with_positions为true时positions为编码后的位置信息，否则为空串，emit可以把它移走
+    //只读地使用分词单例，可以在多个线程中同时调用
+    template<class Emit>
+    static doc_length count_words(const Doc& doc,bool with_positions,Emit emit){
         //建立倒排索引
-        //需要对doc属性中的title content 进行分词，还要进行词频统计。注意字词全转小写，可以只有boost库的to_lower函数
-        //建立一个结构体，属性为title_num content_num.分别表示一个词分别在标题和正文出现的次数
-        struct word_num{
-            int title_num = 0;
-            int content_num = 0;
+        //需要对doc属性中的title content 进行分词，还要进行词频统计。分词结果中的字词已经全转小写
+        //统计一个词分别在标题和正文出现的次数，需要位置信息时顺便记下每次出现的序号和正文中的字节偏移
+        //不用哈希表按词计数（每个不同的词都要申请节点和字符串）：把两个字段的所有词按(词,出现顺序)排序，
+        //同一个词的出现就挨在一起，而且标题在前、正文在后，各自按序号升序
+        //分词结果和下面的数组都是每个线程一份，在文档之间复用
+        struct word_ref{
+            std::string_view word;
+            uint32_t index;//小于title_word.size()时是标题中的第index个词，否则是正文中的第index-title_word.size()个词
         };
-        //定义一个哈希表来映射一个词在文中出现的频率
-        std::unordered_map<std::string,word_num> word_cnt;
-        //先统计title，统计前先分词
-        std::vector<std::string> title_word;
-        JiebaUtil::CutString(doc.title_,&title_word);
-        for(std::string&word:title_word){
-            boost::to_lower(word);
-            word_cnt[word].title_num+=1;
-        }
-        //后统计content
-        std::vector<std::string> content_word;
-        JiebaUtil::CutString(doc.content_,&content_word);
-        for(std::string&word:content_word){
-            boost::to_lower(word);
-            word_cnt[word].content_num+=1;
-        }
-
-        //统计完词频后，开始计算权重，定义标题中出现的权重为5，正文中出现的权重为1
-        #define TITLE 5
-        #define CONTENT 1
-        
-        for(auto&item:word_cnt){
-            int weight = item.second.title_num*TITLE+item.second.content_num*CONTENT;
-            Inverted_item tmp(doc.id_,item.first,weight);
-            
-            inverted_list& tmp_list = inverted_index[item.first];
-            tmp_list.push_back(std::move(tmp));
-        }
-    }
-
-    //根据id查看正排索引
-    Doc* get_forward_index(uint64_t id){
-        if(id>=forward_index.size()){
+        static thread_local token_list title_word;
+        static thread_local token_list content_word;
+        static thread_local std::vector<word_ref> refs;
+        static thread_local std::vector<uint32_t> title_pos;
+        static thread_local std::vector<uint32_t> content_pos;
+        static thread_local std::vector<uint32_t> content_offset;
+        JiebaUtil::CutTokens(doc.title_,&title_word);
+        JiebaUtil::CutTokens(doc.content_,&content_word);
+        const uint32_t title_count = title_word.size();
+        refs.clear();
+        for(uint32_t i = 0;i<title_count;i++){
+            refs.push_back(word_ref{title_word.word(i),i});
+        }
+        for(uint32_t i = 0;i<content_word.size();i++){
+            refs.push_back(word_ref{content_word.word(i),title_count+i});
+        }
+        std::sort(refs.begin(),refs.end(),[](const word_ref& a,const word_ref& b){
+            int cmp = a.word.compare(b.word);
+            return cmp!=0?cmp<0:a.index<b.index;
+        });
+
+        //权重要等所有文档都统计完才能算（BM25F，标题中出现的权重为5，正文中出现的权重为1），这里只交出词频
+        std::string positions;
+        for(size_t begin = 0,end = 0;begin<refs.size();begin = end){
+            term_freq tf;
+            title_pos.clear();
+            content_pos.clear();
+            content_offset.clear();
+            for(end = begin;end<refs.size()&&refs[end].word == refs[begin].word;end++){
+                uint32_t index = refs[end].index;
+                if(index<title_count){
+                    tf.title+=1;
+                    if(with_positions){
+                        title_pos.push_back(title_word.tokens[index].position);
+                    }
+                }else{
+                    const token_pos& token = content_word.tokens[index-title_count];
+                    tf.content+=1;
+                    if(with_positions){
+                        content_pos.push_back(token.position);
+                        content_offset.push_back(token.offset);
+                    }
+                }
+            }
+            positions.clear();
+            if(with_positions){
+                encode_doc_positions(title_pos,content_pos,content_offset,&positions);
+            }
+            emit(refs[begin].word,tf,positions);
+        }
+        doc_length length;
+        length.title = title_word.size();
+        length.content = content_word.size();
+        return length;
+    }
+
+    //把create_inverted_index收集的倒排拉链统一打分、压缩，压缩完释放未压缩的数据，正文压缩失败时返回false
+    bool freeze_index(){
+        stats = bm25_stats();
+        for(const doc_length& length:building_lengths){
+            stats.add(length);
+        }
+        scoring_context scoring;
+        scoring.stats = stats;
+        scoring.doc_count = stats.doc_count;
+        scoring.lengths = building_lengths.data();
+        std::vector<frozen_shard> frozen(1);
+        freeze_shard(building_index,scoring,&frozen[0]);
+        std::vector<doc_length>().swap(building_lengths);
+        append_frozen(frozen);
+        if(!compress_contents(content_refs.size(),1)){
+            return false;
+        }
+        posting_blocks.shrink_to_fit();
+        posting_data.shrink_to_fit();
+        position_blocks.shrink_to_fit();
+        position_data.shrink_to_fit();
+        return true;
+    }
+
+    //文档总数
+    uint64_t doc_count() const {
+        return mapped_base?mapped_header.doc_count:forward_index.size();
+    }
+
+    /*
+    下面的查询接口都是const的，只读正排/倒排索引，不会修改任何容器（倒排索引只用find，不用operator[]）
+    索引建好（freeze）或者加载/映射完快照之后就不再修改，多个查询线程可以不加锁地同时调用
+    建索引、加载快照必须在开始处理查询之前完成
+    */
+    //根据id查看正排索引，结果通过doc带回
+    //正文是压缩的，只有with_content为true时才解压（只用标题、url的调用者应该传false），否则doc->content_为空
+    bool get_forward_index(uint64_t id,DocView* doc,bool with_content = true) const {
+        if(id>=doc_count()){
             LOG(Level::WARNING,"id超出范围");
-            return nullptr;
+            return false;
+        }
+        content_ref ref;
+        if(mapped_base){
+            const doc_entry& entry = mapped_docs[id];
+            *doc = DocView(std::string_view(mapped_strings+entry.title_offset,entry.title_size),std::string_view(),
+                           std::string_view(mapped_strings+entry.url_offset,entry.url_size),id);
+            ref = content_ref{entry.content_block,(uint32_t)entry.content_offset,entry.content_size};
+        }else{
+            const Doc& item = forward_index[id];
+            *doc = DocView(item.title_,item.content_,item.url_,item.id_);
+            if(id>=content_refs.size()){
+                return true;//正文还没有压缩（create_forward_index之后、freeze_index之前）
+            }
+            ref = content_refs[id];
         }
-        return &forward_index[id];
+        if(with_content&&!contents.read(ref,&doc->content_,&doc->content_block_)){
+            LOG(Level::WARNING,"文档%llu的正文解压失败",(unsigned long long)id);
+        }
+        return true;
     }
 
-    //根据字词返回倒排拉链
-    inverted_list* get_inverted_index(const std::string& word){
-        auto iter = inverted_index.find(word);
-        if(iter == inverted_index.end()){
-            //没找到
+    //正文解压块缓存的命中统计
+    cache_stats get_content_cache_stats() const {
+        return contents.get_cache_stats();
+    }
+
+    //最近一次create_index的耗时，索引是从快照加载的时候全部为0
+    const index_build_stats& get_build_stats() const {
+        return build_stats;
+    }
+
+    //索引的规模，包括当前的增量段，可以和查询同时调用
+    index_size_stats get_size_stats() const {
+        index_size_stats result;
+        result.docs = doc_count();
+        result.terms = dictionary.size();
+        if(mapped_base){
+            result.postings = mapped_header.posting_count;
+            result.posting_bytes = mapped_header.block_count*sizeof(posting_block)+mapped_header.posting_size;
+            result.position_bytes = mapped_header.block_count*sizeof(uint32_t)+mapped_header.position_size;
+            result.snapshot_bytes = mapped_size;
+        }else{
+            result.postings = posting_count;
+            result.posting_bytes = posting_blocks.size()*sizeof(posting_block)+posting_data.size();
+            result.position_bytes = position_blocks.size()*sizeof(uint32_t)+position_data.size();
+        }
+        result.content_bytes = contents.block_count()*sizeof(doc_block)+contents.data_size();
+        result.content_raw_bytes = contents.raw_size();
+        std::shared_ptr<const segment_set> set = get_segments();
+        result.segments = set->segments.size();
+        for(auto& segment:set->segments){
+            result.segment_docs+=segment->docs.size();
+        }
+        result.deleted_docs = set->deleted_count;
+        return result;
+    }
+
+    //根据字词返回压缩的倒排拉链，结果通过list带回，用posting_iterator遍历
+    bool get_inverted_index(std::string_view word,posting_list_view* list) const {
+        if(!find_postings(word,list)){
             LOG(Level::WARNING,"字词对应的倒排拉链未找到");
-            return nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    //和get_inverted_index相同，只是找不到时不打日志，给需要同时查多个段的调用者使用
+    bool find_postings(std::string_view word,posting_list_view* list) const {
+        const posting_meta* meta = dictionary.find(word);
+        if(meta == nullptr){
+            //没找到
+            return false;
+        }
+        if(mapped_base){
+            *list = make_posting_view(*meta,mapped_blocks,mapped_postings,mapped_position_blocks,mapped_positions);
+        }else{
+            *list = make_posting_view(*meta,posting_blocks.data(),posting_data.data(),position_blocks.data(),position_data.data());
+        }
+        return true;
+    }
+
+    //基础索引的词典，可以按前缀或者范围枚举字词（只包含基础索引中的词，不包含增量段）
+    const lexicon& get_dictionary() const {
+        return dictionary;
+    }
+
+    //在基础索引的词典上建立输入联想的前缀树，建索引或者加载快照之后、开始查询之前调用
+    void build_suggestions(){
+        suggestions.build(dictionary);
+        LOG(Level::INFO,"输入联想前缀树建立完成，节点%llu个",(unsigned long long)suggestions.node_count());
+    }
+    //输入联想的前缀树，没有调用过build_suggestions时为空，查询结果中的下标用get_dictionary().word_at取词
+    const suggester& get_suggester() const {
+        return suggestions;
+    }
+
+    //把建好的索引写成二进制快照，先写临时文件再rename，避免正在加载的进程读到写了一半的文件
+    bool save_index(const std::string& output){
+        if(mapped_base){
+            LOG(Level::WARNING,"mmap模式下的索引是只读的，不需要再保存快照");
+            return false;
+        }
+        //词典已经按字典序排好，词典项、哈希槽和词典字符串区原样写出，只有倒排拉链的位置需要改
+        const uint64_t term_count = dictionary.size();
+        const term_entry* terms = dictionary.entries();
+
+        //先计算各段的位置
+        index_header header;
+        memset(&header,0,sizeof(header));
+        memcpy(header.magic,INDEX_MAGIC,sizeof(header.magic));
+        header.version = INDEX_VERSION;
+        header.header_size = sizeof(index_header);
+        header.doc_count = forward_index.size();
+        header.term_count = term_count;
+        header.slot_count = dictionary.slot_count();
+        header.posting_count = posting_count;
+        header.title_tokens = stats.title_tokens;
+        header.content_tokens = stats.content_tokens;
+        header.block_count = posting_blocks.size();
+        header.doc_block_count = contents.block_count();
+        header.doc_offset = sizeof(index_header);
+        header.doc_block_offset = header.doc_offset+header.doc_count*sizeof(doc_entry);
+        header.term_offset = header.doc_block_offset+header.doc_block_count*sizeof(doc_block);
+        header.slot_offset = header.term_offset+header.term_count*sizeof(term_entry);
+        header.block_offset = header.slot_offset+header.slot_count*sizeof(lexicon_slot);
+        header.position_block_offset = header.block_offset+header.block_count*sizeof(posting_block);
+        header.posting_offset = header.position_block_offset+header.block_count*sizeof(uint32_t);
+        header.posting_size = posting_data.size();
+        header.position_offset = header.posting_offset+header.posting_size;
+        header.position_size = position_data.size();
+        header.term_string_offset = header.position_offset+header.position_size;
+        header.term_string_size = dictionary.string_size();
+        header.doc_data_offset = header.term_string_offset+header.term_string_size;
+        header.doc_data_size = contents.data_size();
+        header.string_offset = header.doc_data_offset+header.doc_data_size;
+        for(const Doc&doc:forward_index){
+            header.string_size+=doc.title_.size()+doc.url_.size();
+        }
+        header.file_size = header.string_offset+header.string_size;
+
+        std::string tmp_path = output+".tmp";
+        std::ofstream ofm(tmp_path,std::ios::out|std::ios::binary|std::ios::trunc);
+        if(!ofm.is_open()){
+            LOG(Level::ERROR,"%s快照文件打开失败",tmp_path.c_str());
+            return false;
+        }
+        ofm.write((const char*)&header,sizeof(header));
+
+        //正排索引，正文的块表和压缩数据原样写出
+        uint64_t string_pos = 0;
+        for(uint64_t id = 0;id<forward_index.size();id++){
+            const Doc& doc = forward_index[id];
+            doc_entry entry;
+            memset(&entry,0,sizeof(entry));
+            entry.title_offset = string_pos;
+            entry.title_size = doc.title_.size();
+            string_pos+=doc.title_.size();
+            entry.content_block = content_refs[id].block;
+            entry.content_offset = content_refs[id].offset;
+            entry.content_size = content_refs[id].size;
+            entry.url_offset = string_pos;
+            entry.url_size = doc.url_.size();
+            string_pos+=doc.url_.size();
+            ofm.write((const char*)&entry,sizeof(entry));
+        }
+        ofm.write((const char*)contents.blocks(),header.doc_block_count*sizeof(doc_block));
+        //词典，倒排拉链和位置信息按词典顺序重新排列，块表中的偏移是相对每个词自己的数据起点，可以原样拷贝
+        uint64_t data_pos = 0;
+        uint64_t position_pos = 0;
+        uint32_t block_pos = 0;
+        for(uint64_t i = 0;i<term_count;i++){
+            term_entry entry = terms[i];
+            entry.postings.data_offset = data_pos;
+            entry.postings.block_begin = block_pos;
+            entry.postings.position_offset = position_pos;
+            data_pos+=terms[i].postings.data_size;
+            position_pos+=terms[i].postings.position_size;
+            block_pos+=terms[i].postings.block_count;
+            ofm.write((const char*)&entry,sizeof(entry));
+        }
+        ofm.write((const char*)dictionary.slots(),header.slot_count*sizeof(lexicon_slot));
+        //倒排拉链
+        for(uint64_t i = 0;i<term_count;i++){
+            const posting_meta& meta = terms[i].postings;
+            ofm.write((const char*)(posting_blocks.data()+meta.block_begin),meta.block_count*sizeof(posting_block));
+        }
+        //位置块表，没有记录位置信息时全部为0
+        std::vector<uint32_t> zeros;
+        for(uint64_t i = 0;i<term_count;i++){
+            const posting_meta& meta = terms[i].postings;
+            if(meta.block_begin+meta.block_count<=position_blocks.size()){
+                ofm.write((const char*)(position_blocks.data()+meta.block_begin),meta.block_count*sizeof(uint32_t));
+            }else{
+                zeros.assign(meta.block_count,0);
+                ofm.write((const char*)zeros.data(),meta.block_count*sizeof(uint32_t));
+            }
+        }
+        for(uint64_t i = 0;i<term_count;i++){
+            const posting_meta& meta = terms[i].postings;
+            ofm.write((const char*)(posting_data.data()+meta.data_offset),meta.data_size);
+        }
+        for(uint64_t i = 0;i<term_count;i++){
+            const posting_meta& meta = terms[i].postings;
+            ofm.write((const char*)(position_data.data()+meta.position_offset),meta.position_size);
+        }
+        ofm.write(dictionary.strings(),header.term_string_size);
+        ofm.write((const char*)contents.data(),header.doc_data_size);
+        //字符串区，顺序与上面计算偏移时一致
+        for(const Doc&doc:forward_index){
+            ofm.write(doc.title_.data(),doc.title_.size());
+            ofm.write(doc.url_.data(),doc.url_.size());
+        }
+        ofm.close();
+        if(!ofm){
+            LOG(Level::ERROR,"%s快照写入失败",tmp_path.c_str());
+            std::remove(tmp_path.c_str());
+            return false;
         }
-        return &(inverted_index[word]);
+        if(std::rename(tmp_path.c_str(),output.c_str())!=0){
+            LOG(Level::ERROR,"%s快照重命名失败",output.c_str());
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        LOG(Level::INFO,"索引快照保存成功，文档数%llu，字词数%llu",
+            (unsigned long long)header.doc_count,(unsigned long long)header.term_count);
+        return true;
+    }
+
+    //加载二进制快照，整个文件一次性读入内存后再还原正排/倒排索引
+    bool load_index(const std::string& input){
+        std::ifstream ifm(input,std::ios::in|std::ios::binary|std::ios::ate);
+        if(!ifm.is_open()){
+            LOG(Level::WARNING,"%s快照文件打开失败",input.c_str());
+            return false;
+        }
+        std::streamsize file_size = ifm.tellg();
+        if(file_size<(std::streamsize)sizeof(index_header)){
+            LOG(Level::WARNING,"%s快照文件不完整",input.c_str());
+            return false;
+        }
+        std::vector<char> buff(file_size);
+        ifm.seekg(0,std::ios::beg);
+        if(!ifm.read(buff.data(),file_size)){
+            LOG(Level::WARNING,"%s快照文件读取失败",input.c_str());
+            return false;
+        }
+        ifm.close();
+
+        index_header header;
+        if(!check_snapshot(buff.data(),buff.size(),input,&header)){
+            return false;
+        }
+        const doc_entry* docs = (const doc_entry*)(buff.data()+header.doc_offset);
+        const term_entry* terms = (const term_entry*)(buff.data()+header.term_offset);
+        const lexicon_slot* slots = (const lexicon_slot*)(buff.data()+header.slot_offset);
+        const posting_block* blocks = (const posting_block*)(buff.data()+header.block_offset);
+        const uint8_t* postings = (const uint8_t*)(buff.data()+header.posting_offset);
+        const uint32_t* position_block_array = (const uint32_t*)(buff.data()+header.position_block_offset);
+        const uint8_t* positions = (const uint8_t*)(buff.data()+header.position_offset);
+        const char* strings = buff.data()+header.string_offset;
+
+        std::vector<Doc> forward;
+        std::vector<content_ref> refs;
+        forward.reserve(header.doc_count);
+        refs.reserve(header.doc_count);
+        for(uint64_t i = 0;i<header.doc_count;i++){
+            const doc_entry& entry = docs[i];
+            forward.emplace_back(std::string(strings+entry.title_offset,entry.title_size),std::string(),
+                                 std::string(strings+entry.url_offset,entry.url_size),i);
+            refs.push_back(content_ref{entry.content_block,(uint32_t)entry.content_offset,entry.content_size});
+        }
+        unmap_index();
+        reset_segments();
+        forward_index.swap(forward);
+        content_refs.swap(refs);
+        contents.assign((const doc_block*)(buff.data()+header.doc_block_offset),header.doc_block_count,
+                        (const uint8_t*)(buff.data()+header.doc_data_offset),header.doc_data_size);
+        suggestions.clear();
+        //词典、块表和数据区都原样拷贝，词典中记录的位置直接可用
+        dictionary.assign(terms,header.term_count,slots,header.slot_count,
+                          buff.data()+header.term_string_offset,header.term_string_size);
+        posting_blocks.assign(blocks,blocks+header.block_count);
+        posting_data.assign(postings,postings+header.posting_size);
+        position_blocks.assign(position_block_array,position_block_array+header.block_count);
+        position_data.assign(positions,positions+header.position_size);
+        posting_count = header.posting_count;
+        stats = snapshot_stats(header);
+        LOG(Level::INFO,"索引快照加载成功，文档数%llu，字词数%llu",
+            (unsigned long long)header.doc_count,(unsigned long long)header.term_count);
+        return true;
+    }
+
+    //只读地mmap快照，之后的查询都直接返回映射区中的视图
+    bool map_index(const std::string& input){
+        int fd = open(input.c_str(),O_RDONLY);
+        if(fd<0){
+            LOG(Level::WARNING,"%s快照文件打开失败",input.c_str());
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd,&st)<0||st.st_size<(off_t)sizeof(index_header)){
+            LOG(Level::WARNING,"%s快照文件不完整",input.c_str());
+            close(fd);
+            return false;
+        }
+        void* base = mmap(nullptr,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+        close(fd);//映射建立后fd就可以关闭了
+        if(base == MAP_FAILED){
+            LOG(Level::WARNING,"%s快照mmap失败",input.c_str());
+            return false;
+        }
+        index_header header;
+        if(!check_snapshot((const char*)base,st.st_size,input,&header)){
+            munmap(base,st.st_size);
+            return false;
+        }
+        //提前把快照读进page cache，热替换后的第一批查询不会因为缺页而变慢
+        madvise(base,st.st_size,MADV_WILLNEED);
+        unmap_index();
+        reset_segments();
+        //堆内存中的索引不再使用，释放掉
+        std::vector<Doc>().swap(forward_index);
+        std::vector<content_ref>().swap(content_refs);
+        std::vector<posting_block>().swap(posting_blocks);
+        std::vector<uint8_t>().swap(posting_data);
+        std::vector<uint32_t>().swap(position_blocks);
+        std::vector<uint8_t>().swap(position_data);
+        posting_count = 0;
+        stats = snapshot_stats(header);
+        mapped_base = (const char*)base;
+        mapped_size = st.st_size;
+        mapped_header = header;
+        mapped_docs = (const doc_entry*)(mapped_base+header.doc_offset);
+        contents.attach((const doc_block*)(mapped_base+header.doc_block_offset),header.doc_block_count,
+                        (const uint8_t*)(mapped_base+header.doc_data_offset),header.doc_data_size);
+        suggestions.clear();
+        dictionary.attach((const term_entry*)(mapped_base+header.term_offset),header.term_count,
+                          (const lexicon_slot*)(mapped_base+header.slot_offset),header.slot_count,
+                          mapped_base+header.term_string_offset,header.term_string_size);
+        mapped_blocks = (const posting_block*)(mapped_base+header.block_offset);
+        mapped_postings = (const uint8_t*)(mapped_base+header.posting_offset);
+        mapped_position_blocks = (const uint32_t*)(mapped_base+header.position_block_offset);
+        mapped_positions = (const uint8_t*)(mapped_base+header.position_offset);
+        mapped_strings = mapped_base+header.string_offset;
+        LOG(Level::INFO,"索引快照映射成功，文档数%llu，字词数%llu",
+            (unsigned long long)header.doc_count,(unsigned long long)header.term_count);
+        return true;
+    }
+    //当前的增量段和删除标记，查询开始时取一次，整个查询都使用这一份
+    std::shared_ptr<const segment_set> get_segments() const {
+        return std::atomic_load(&segments);
+    }
+
+    /*
+    应用变更日志中上次之后追加的完整行，返回应用的变更条数，日志不存在时返回0
+    新增/修改的文档建成一个新的增量段，旧版本打上删除标记，最后整体发布新的segment_set
+    耗时只和变更的文档数有关（第一次调用时需要建立一次url到id的映射）
+    */
+    int apply_delta(const std::string& path){
+        std::lock_guard<std::mutex> lock(update_mtx);
+        std::ifstream ifm(path,std::ios::in|std::ios::binary|std::ios::ate);
+        if(!ifm.is_open()){
+            return 0;
+        }
+        uint64_t file_size = ifm.tellg();
+        if(file_size<delta_offset){
+            //变更日志被清空后又追加了新的变更，从头开始应用，新增/修改/删除按url处理，重复应用不影响结果
+            delta_offset = 0;
+        }
+        ifm.seekg(delta_offset,std::ios::beg);
+        //同一个url只保留最后一次变更，urls记录url第一次出现的顺序
+        std::vector<std::string> urls;
+        std::unordered_map<std::string,std::string> last_change;
+        std::string line;
+        uint64_t offset = delta_offset;
+        int change_count = 0;
+        while(std::getline(ifm,line)){
+            if(ifm.eof()){
+                break;//最后一行还没有写完，下次再处理
+            }
+            offset+=line.size()+1;
+            if(line.size()<2||line[1]!='\3'||(line[0]!='A'&&line[0]!='U'&&line[0]!='D')){
+                LOG(Level::WARNING,"变更日志格式错误");
+                continue;
+            }
+            std::string url = line.substr(line.rfind('\3')+1);
+            auto iter = last_change.find(url);
+            if(iter == last_change.end()){
+                urls.push_back(url);
+                last_change.emplace(url,std::move(line));
+            }else{
+                iter->second = std::move(line);
+            }
+            change_count++;
+        }
+        delta_offset = offset;
+        if(change_count == 0){
+            return 0;
+        }
+        if(!url_ids_ready){
+            build_url_ids();
+        }
+
+        std::shared_ptr<const segment_set> old_set = get_segments();
+        auto set = std::make_shared<segment_set>(*old_set);
+        auto segment = std::make_shared<index_segment>();
+        segment->base_id = old_set->segments.empty()?doc_count():old_set->segments.back()->end_id();
+        for(const std::string& url:urls){
+            std::string& change = last_change[url];
+            auto iter = url_ids.find(url);
+            if(iter!=url_ids.end()){
+                set->mark_deleted(iter->second);
+                url_ids.erase(iter);
+            }
+            if(change[0] == 'D'){
+                continue;
+            }
+            std::string data_line = change.substr(2);
+            Doc doc;
+            if(!parse_doc(data_line,segment->end_id(),&doc)){
+                LOG(Level::WARNING,"正排索引创建失败");
+                continue;
+            }
+            url_ids[doc.url_] = doc.id_;
+            segment->docs.push_back(std::move(doc));
+        }
+        if(!segment->docs.empty()){
+            building_postings building;
+            std::vector<doc_length> lengths;
+            lengths.reserve(segment->docs.size());
+            for(const Doc& doc:segment->docs){
+                lengths.push_back(count_words(doc,store_positions,[&](std::string_view word,const term_freq& tf,std::string& positions){
+                    building.get(word).emplace_back(doc.id_,tf,std::move(positions));
+                }));
+            }
+            scoring_context scoring = delta_scoring(segment->end_id(),set->deleted_count);
+            scoring.lengths = lengths.data();
+            scoring.base_id = segment->base_id;
+            freeze_segment(building,scoring,segment.get());
+            set->segments.push_back(segment);
+        }
+        set->generation = next_index_generation();
+        size_t segment_count = set->segments.size();
+        std::atomic_store(&segments,std::shared_ptr<const segment_set>(set));
+        LOG(Level::INFO,"应用%d条变更，新增文档%llu个，增量段%llu个，已删除文档%llu个",change_count,
+            (unsigned long long)segment->docs.size(),(unsigned long long)segment_count,(unsigned long long)set->deleted_count);
+        if(segment_count>MAX_DELTA_SEGMENTS&&!merging.exchange(true)){
+            //由shared_ptr管理的索引可能在合并期间被热替换掉，后台线程持有一份引用，合并完成前不会被释放
+            //单例一直存活到进程结束，self为空也没关系
+            std::shared_ptr<Index> self = weak_from_this().lock();
+            std::thread([this,self]{
+                merge_segments();
+                merging = false;
+            }).detach();
+        }
+        return change_count;
+    }
+
+    //用raw.txt重建索引之后，之前的变更都已经包含在索引里了，清空变更日志
+    void reset_delta(const std::string& path){
+        std::lock_guard<std::mutex> lock(update_mtx);
+        std::ofstream ofm(path,std::ios::out|std::ios::trunc);
+        delta_offset = 0;
+    }
+
+    //把当前所有的增量段合并成一个，丢掉已删除文档的倒排元素和正文，合并期间查询照常使用旧的段
+    void merge_segments(){
+        std::shared_ptr<const segment_set> set = get_segments();
+        size_t merge_count = set->segments.size();
+        if(merge_count<2){
+            return;
+        }
+        auto merged = std::make_shared<index_segment>();
+        merged->base_id = set->segments.front()->base_id;
+        building_postings building;
+        for(size_t i = 0;i<merge_count;i++){
+            const index_segment& segment = *set->segments[i];
+            for(const Doc& doc:segment.docs){
+                if(set->is_deleted(doc.id_)){
+                    merged->docs.emplace_back("","","",doc.id_);
+                }else{
+                    merged->docs.push_back(doc);
+                }
+            }
+            //段之间的id是递增的，按段的顺序追加后每个词的倒排拉链仍然有序
+            for(uint64_t t = 0;t<segment.terms.size();t++){
+                posting_list_view list = make_posting_view(segment.terms.postings_at(t),segment.blocks.data(),segment.data.data(),
+                                                           segment.position_blocks.data(),segment.position_data.data());
+                inverted_list& items = building.get(segment.terms.word_at(t));
+                for(posting_iterator iter(list);iter.valid();iter.next()){
+                    if(!set->is_deleted(iter.id())){
+                        const uint8_t* begin = nullptr;
+                        const uint8_t* end = nullptr;
+                        iter.positions(&begin,&end);
+                        items.emplace_back(iter.id(),iter.tf_weight(),std::string((const char*)begin,end-begin));
+                    }
+                }
+            }
+        }
+        //只出现在已删除文档中的词倒排拉链为空，freeze_shard会跳过它们
+        //权重原样保留，只按合并后的文档频率重新计算idf
+        freeze_segment(building,delta_scoring(set->segments[merge_count-1]->end_id(),set->deleted_count),merged.get());
+
+        std::lock_guard<std::mutex> lock(update_mtx);
+        //合并期间可能又追加了新的段，只替换参与合并的前merge_count个
+        //期间段被重置（重新加载、重建索引）或者替换过时，这些段已经不在了，丢弃合并结果
+        std::shared_ptr<const segment_set> current = get_segments();
+        if(current->segments.size()<merge_count
+           ||!std::equal(set->segments.begin(),set->segments.begin()+merge_count,current->segments.begin())){
+            LOG(Level::INFO,"合并期间增量段已经变化，丢弃合并结果");
+            return;
+        }
+        auto next = std::make_shared<segment_set>(*current);
+        next->segments.erase(next->segments.begin(),next->segments.begin()+merge_count);
+        next->segments.insert(next->segments.begin(),merged);
+        //合并后idf重新计算过，分数和合并前不同，换一个版本号让结果缓存失效
+        next->generation = next_index_generation();
+        std::atomic_store(&segments,std::shared_ptr<const segment_set>(next));
+        LOG(Level::INFO,"合并%llu个增量段完成",(unsigned long long)merge_count);
     }
 private:
-    static Index* instance;
+    //给倒排元素打分需要的参数
+    struct scoring_context{
+        bm25_stats stats;//字段的平均长度
+        uint64_t doc_count = 0;//计算idf用的文档数
+        const doc_length* lengths = nullptr;//下标为id-base_id，为nullptr时倒排元素的weight_已经算好了
+        uint64_t base_id = 0;
+        const Index* base = nullptr;//不为nullptr时，词的文档频率还要加上基础索引中的
+    };
+
+    //增量段打分：平均长度沿用基础索引的（新增文档很少，不影响），文档数和文档频率都算上基础索引
+    //基础索引中的idf建索引时就固定了，重建快照时所有的idf才会一起更新
+    scoring_context delta_scoring(uint64_t end_id,uint64_t deleted_count) const {
+        scoring_context scoring;
+        scoring.stats = stats;
+        scoring.doc_count = end_id>deleted_count?end_id-deleted_count:0;
+        scoring.base = this;
+        return scoring;
+    }
+
+    static bm25_stats snapshot_stats(const index_header& header){
+        bm25_stats result;
+        result.doc_count = header.doc_count;
+        result.title_tokens = header.title_tokens;
+        result.content_tokens = header.content_tokens;
+        return result;
+    }
+
+    //一个分片压缩后的结果，词的位置信息都是相对分片自己的块表和数据区
+    struct frozen_shard{
+        std::vector<std::pair<std::string,posting_meta>> terms;
+        std::vector<posting_block> blocks;
+        std::vector<uint8_t> data;
+        std::vector<uint32_t> position_blocks;
+        std::vector<uint8_t> position_data;
+        uint64_t posting_count = 0;
+    };
+
+    //把一个分片的倒排拉链按id排序后打分、压缩，分片的数据压缩完即释放
+    //倒排拉链为空的词不进入词典
+    static void freeze_shard(building_postings& shard,const scoring_context& scoring,frozen_shard* out){
+        out->terms.reserve(shard.size());
+        for(uint32_t id = 0;id<shard.size();id++){
+            inverted_list& list = shard.lists[id];
+            if(list.empty()){
+                continue;
+            }
+            std::string_view word = shard.terms.word(id);
+            //倒排拉链需要按id升序才能做差值编码
+            std::sort(list.begin(),list.end(),[](const Inverted_item&a,const Inverted_item&b){
+                return a.id_<b.id_;
+            });
+            if(scoring.lengths){
+                for(Inverted_item& posting:list){
+                    posting.weight_ = bm25_tf(posting.tf_,scoring.lengths[posting.id_-scoring.base_id],scoring.stats);
+                }
+            }
+            uint64_t df = list.size();
+            posting_list_view base_list;
+            if(scoring.base&&scoring.base->find_postings(word,&base_list)){
+                df+=base_list.size();
+            }
+            posting_meta meta = encode_postings(list.begin(),list.end(),out->blocks,out->data);
+            meta.idf = bm25_idf(scoring.doc_count,df);
+            encode_positions(list.begin(),list.end(),out->position_blocks,out->position_data,&meta);
+            out->terms.emplace_back(std::string(word),meta);
+            out->posting_count+=list.size();
+            inverted_list().swap(list);
+        }
+        shard = building_postings();
+    }
+
+    //把压缩好的分片拼接到全局的块表和数据区后面，再和已有的词一起重新建立词典
+    //分片按词的哈希划分，不同分片之间没有重复的词
+    void append_frozen(std::vector<frozen_shard>& shards){
+        std::vector<std::pair<std::string,posting_meta>> terms;
+        terms.reserve(dictionary.size());
+        for(uint64_t i = 0;i<dictionary.size();i++){
+            terms.emplace_back(std::string(dictionary.word_at(i)),dictionary.postings_at(i));
+        }
+        for(frozen_shard& shard:shards){
+            uint64_t data_base = posting_data.size();
+            uint64_t position_base = position_data.size();
+            uint32_t block_base = posting_blocks.size();
+            posting_blocks.insert(posting_blocks.end(),shard.blocks.begin(),shard.blocks.end());
+            posting_data.insert(posting_data.end(),shard.data.begin(),shard.data.end());
+            position_blocks.insert(position_blocks.end(),shard.position_blocks.begin(),shard.position_blocks.end());
+            position_data.insert(position_data.end(),shard.position_data.begin(),shard.position_data.end());
+            for(auto&term:shard.terms){
+                term.second.data_offset+=data_base;
+                term.second.position_offset+=position_base;
+                term.second.block_begin+=block_base;
+                terms.emplace_back(std::move(term.first),term.second);
+            }
+            posting_count+=shard.posting_count;
+            shard = frozen_shard();//释放分片占用的内存
+        }
+        suggestions.clear();
+        dictionary.build(terms);
+    }
+
+    //把forward_index[first_id,...)的正文按块压缩到contents，再释放Doc里的正文
+    //文档按id分成thread_num段并行压缩，段与段之间的块不拼在一起，只多出几个不满的块
+    //zlib压缩失败时返回false，不把损坏的块写进正文存储
+    bool compress_contents(uint64_t first_id,int thread_num){
+        uint64_t count = forward_index.size()-first_id;
+        if(thread_num<1){
+            thread_num = 1;
+        }
+        std::vector<doc_store_builder> builders(thread_num);
+        std::vector<char> finished(thread_num,0);
+        content_refs.resize(forward_index.size());
+        std::vector<std::thread> workers;
+        for(int t = 0;t<thread_num;t++){
+            workers.emplace_back([this,&builders,&finished,first_id,count,thread_num,t]{
+                uint64_t begin = first_id+count*t/thread_num;
+                uint64_t end = first_id+count*(t+1)/thread_num;
+                for(uint64_t id = begin;id<end;id++){
+                    content_refs[id] = builders[t].add(forward_index[id].content_);
+                    std::string().swap(forward_index[id].content_);
+                }
+                finished[t] = builders[t].finish();
+            });
+        }
+        for(std::thread& worker:workers){
+            worker.join();
+        }
+        if(std::count(finished.begin(),finished.end(),0)>0){
+            LOG(Level::FATAL,"正文压缩失败");
+            return false;
+        }
+        for(int t = 0;t<thread_num;t++){
+            uint32_t block_base = contents.append(builders[t]);
+            for(uint64_t id = first_id+count*t/thread_num;id<first_id+count*(t+1)/thread_num;id++){
+                content_refs[id].block+=block_base;
+            }
+        }
+        contents.shrink_to_fit();
+        LOG(Level::INFO,"正文压缩完成，%llu块，%llu字节压缩到%llu字节",(unsigned long long)contents.block_count(),
+            (unsigned long long)contents.raw_size(),(unsigned long long)contents.data_size());
+        return true;
+    }
+
+    //把增量段收集的倒排拉链压缩到段自己的块表和数据区
+    static void freeze_segment(building_postings& building,const scoring_context& scoring,index_segment* segment){
+        frozen_shard shard;
+        freeze_shard(building,scoring,&shard);
+        segment->terms.build(shard.terms);
+        segment->blocks.swap(shard.blocks);
+        segment->data.swap(shard.data);
+        segment->position_blocks.swap(shard.position_blocks);
+        segment->position_data.swap(shard.position_data);
+    }
+
+    //第一次应用变更前，根据基础索引和已有的增量段建立url到文档id的映射
+    void build_url_ids(){
+        std::shared_ptr<const segment_set> set = get_segments();
+        for(uint64_t id = 0;id<doc_count();id++){
+            DocView doc;
+            if(get_forward_index(id,&doc,false)&&!set->is_deleted(id)){
+                url_ids[std::string(doc.url_)] = id;
+            }
+        }
+        for(auto& segment:set->segments){
+            for(const Doc& doc:segment->docs){
+                if(!set->is_deleted(doc.id_)){
+                    url_ids[doc.url_] = doc.id_;
+                }
+            }
+        }
+        url_ids_ready = true;
+    }
+
+    //基础索引被替换时，之前的增量段和删除标记都不再有效
+    void reset_segments(){
+        std::lock_guard<std::mutex> lock(update_mtx);
+        auto set = std::make_shared<segment_set>();
+        set->generation = next_index_generation();
+        std::atomic_store(&segments,std::shared_ptr<const segment_set>(set));
+        std::unordered_map<std::string,uint64_t>().swap(url_ids);
+        url_ids_ready = false;
+        delta_offset = 0;
+    }
+
+    void unmap_index(){
+        if(mapped_base){
+            munmap((void*)mapped_base,mapped_size);
+            mapped_base = nullptr;
+            mapped_size = 0;
+        }
+    }
+
+    //校验快照：文件头、各段范围以及每一项的偏移都不能越界，校验通过后才能直接按数组访问
+    bool check_snapshot(const char* base,size_t size,const std::string& input,index_header* header){
+        memcpy(header,base,sizeof(index_header));
+        if(memcmp(header->magic,INDEX_MAGIC,sizeof(header->magic))!=0){
+            LOG(Level::WARNING,"%s不是索引快照文件",input.c_str());
+            return false;
+        }
+        if(header->version!=INDEX_VERSION||header->header_size!=sizeof(index_header)){
+            LOG(Level::WARNING,"%s快照版本%u不匹配，需要版本%u",input.c_str(),header->version,INDEX_VERSION);
+            return false;
+        }
+        if(header->file_size!=size
+            ||header->doc_offset%8!=0||header->term_offset%8!=0||header->slot_offset%4!=0||header->block_offset%4!=0
+            ||header->doc_block_offset%8!=0
+            ||header->doc_offset+header->doc_count*sizeof(doc_entry)>header->doc_block_offset
+            ||header->doc_block_offset+header->doc_block_count*sizeof(doc_block)>header->term_offset
+            ||header->term_offset+header->term_count*sizeof(term_entry)>header->slot_offset
+            ||header->slot_offset+header->slot_count*sizeof(lexicon_slot)>header->block_offset
+            ||header->position_block_offset%4!=0
+            ||header->block_offset+header->block_count*sizeof(posting_block)>header->position_block_offset
+            ||header->position_block_offset+header->block_count*sizeof(uint32_t)>header->posting_offset
+            ||header->posting_offset+header->posting_size>header->position_offset
+            ||header->position_offset+header->position_size>header->term_string_offset
+            ||header->term_string_offset+header->term_string_size>header->doc_data_offset
+            ||header->doc_data_offset+header->doc_data_size>header->string_offset
+            ||header->string_offset+header->string_size!=header->file_size){
+            LOG(Level::WARNING,"%s快照文件损坏",input.c_str());
+            return false;
+        }
+        const doc_entry* docs = (const doc_entry*)(base+header->doc_offset);
+        const doc_block* doc_blocks = (const doc_block*)(base+header->doc_block_offset);
+        if(!doc_store::validate(doc_blocks,header->doc_block_count,header->doc_data_size)){
+            LOG(Level::WARNING,"%s快照正文损坏",input.c_str());
+            return false;
+        }
+        for(uint64_t i = 0;i<header->doc_count;i++){
+            const doc_entry& entry = docs[i];
+            if(entry.title_offset+entry.title_size>header->string_size
+                ||entry.url_offset+entry.url_size>header->string_size
+                ||(entry.content_size>0&&(entry.content_block>=header->doc_block_count
+                    ||entry.content_offset+entry.content_size>doc_blocks[entry.content_block].raw_size))){
+                LOG(Level::WARNING,"%s快照正排索引损坏",input.c_str());
+                return false;
+            }
+        }
+        const term_entry* terms = (const term_entry*)(base+header->term_offset);
+        if(!lexicon::validate(terms,header->term_count,(const lexicon_slot*)(base+header->slot_offset),header->slot_count,header->term_string_size)){
+            LOG(Level::WARNING,"%s快照词典损坏",input.c_str());
+            return false;
+        }
+        const posting_block* blocks = (const posting_block*)(base+header->block_offset);
+        const uint32_t* position_blocks = (const uint32_t*)(base+header->position_block_offset);
+        for(uint64_t i = 0;i<header->term_count;i++){
+            const posting_meta& meta = terms[i].postings;
+            if(meta.data_offset+meta.data_size>header->posting_size
+                ||meta.position_offset+meta.position_size>header->position_size
+                ||(uint64_t)meta.block_begin+meta.block_count>header->block_count){
+                LOG(Level::WARNING,"%s快照倒排索引损坏",input.c_str());
+                return false;
+            }
+            for(uint32_t j = 0;j<meta.block_count;j++){
+                if(blocks[meta.block_begin+j].offset>meta.data_size
+                    ||(meta.position_size>0&&position_blocks[meta.block_begin+j]>meta.position_size)){
+                    LOG(Level::WARNING,"%s快照倒排索引损坏",input.c_str());
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    static std::atomic<Index*> instance;
     static std::mutex mtx;
 };
 
-Index* Index::instance = nullptr;
-std::mutex Index::mtx;
\ No newline at end of file
+std::atomic<Index*> Index::instance{nullptr};
+std::mutex Index::mtx;
+
+/*
+查询使用的只读视图：基础索引 + 某一时刻的增量段和删除标记
+查询开始时构造一次，查询过程中看到的索引不会因为并发的增量更新而变化
+*/
+class index_reader{
+public:
+    explicit index_reader(const Index* index)
+    :index_(index)
+    ,set_(index->get_segments())
+    {}
+    //文档id的上界（包括已删除的文档）
+    uint64_t doc_count() const {
+        return set_->segments.empty()?index_->doc_count():set_->segments.back()->end_id();
+    }
+    bool has_deleted() const {
+        return set_->deleted_count>0;
+    }
+    bool is_deleted(uint64_t id) const {
+        return set_->is_deleted(id);
+    }
+    uint64_t generation() const {
+        return set_->generation;
+    }
+    //增量段中的文档很少，正文不压缩，with_content只对基础索引有影响
+    bool get_forward_index(uint64_t id,DocView* doc,bool with_content = true) const {
+        if(id<index_->doc_count()){
+            return index_->get_forward_index(id,doc,with_content);
+        }
+        auto iter = std::upper_bound(set_->segments.begin(),set_->segments.end(),id,
+            [](uint64_t key,const std::shared_ptr<const index_segment>& segment){
+                return key<segment->base_id;
+            });
+        if(iter == set_->segments.begin()||id>=(*(iter-1))->end_id()){
+            LOG(Level::WARNING,"id超出范围");
+            return false;
+        }
+        const Doc& item = (*(iter-1))->docs[id-(*(iter-1))->base_id];
+        *doc = DocView(item.title_,item.content_,item.url_,item.id_);
+        return true;
+    }
+    //一个词在基础索引和每个增量段中各有一条倒排拉链，都通过lists带回，各拉链的文档id互不相交
+    bool get_inverted_index(const std::string& word,std::vector<posting_list_view>* lists) const {
+        lists->clear();
+        posting_list_view list;
+        if(index_->find_postings(word,&list)){
+            lists->push_back(list);
+        }
+        for(auto& segment:set_->segments){
+            if(segment->get_inverted_index(word,&list)){
+                lists->push_back(list);
+            }
+        }
+        if(lists->empty()){
+            LOG(Level::WARNING,"字词对应的倒排拉链未找到");
+            return false;
+        }
+        return true;
+    }
+private:
+    const Index* index_;
+    std::shared_ptr<const segment_set> set_;
+};
\ No newline at end of file
@@ -0,0 +1,103 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，json输出篇
+搜索结果原来是先拼一棵Json::Value树（每个字段都拷贝一份字符串），再用Json::FastWriter序列化成另一个字符串，
+http服务再拷贝一次放进响应。结果的结构是固定的，所以改成直接把转义后的字段追加到一个可以复用的缓冲区里：
+- 转义规则和jsoncpp（1.9.x）的FastWriter完全一致，输出的字节和原来一样，缓存、前端都不需要改：
+  控制字符、引号、反斜杠转义，非ASCII字符写成\uXXXX（BMP之外的写成代理对），不合法的UTF-8写成\ufffd，
+  所以正文中有坏字节时输出也是合法的json
+- 连续的不需要转义的ASCII字节整段追加
+- http服务用content provider直接从这个缓冲区写出响应，不再拷贝到res.body
+*/
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+//把一个UTF-16码元写成\uXXXX（小写十六进制）
+inline void append_json_unicode(uint32_t unit,std::string* out){
+    static const char hex[] = "0123456789abcdef";
+    char buff[6] = {'\\','u',hex[(unit>>12)&0xF],hex[(unit>>8)&0xF],hex[(unit>>4)&0xF],hex[unit&0xF]};
+    out->append(buff,sizeof(buff));
+}
+
+//从p开始解码一个UTF-8字符，p移到这个字符的最后一个字节；不合法时返回0xFFFD，和jsoncpp的处理一致
+inline uint32_t json_decode_utf8(const char*& p,const char* end){
+    const uint32_t replacement = 0xFFFD;
+    uint32_t first = (uint8_t)*p;
+    if(first<0xE0){
+        if(end-p<2){
+            return replacement;
+        }
+        uint32_t code = ((first&0x1F)<<6)|((uint8_t)p[1]&0x3F);
+        p+=1;
+        return code<0x80?replacement:code;
+    }
+    if(first<0xF0){
+        if(end-p<3){
+            return replacement;
+        }
+        uint32_t code = ((first&0x0F)<<12)|(((uint8_t)p[1]&0x3F)<<6)|((uint8_t)p[2]&0x3F);
+        p+=2;
+        if(code>=0xD800&&code<=0xDFFF){
+            return replacement;
+        }
+        return code<0x800?replacement:code;
+    }
+    if(first<0xF8){
+        if(end-p<4){
+            return replacement;
+        }
+        uint32_t code = ((first&0x07)<<18)|(((uint8_t)p[1]&0x3F)<<12)|(((uint8_t)p[2]&0x3F)<<6)|((uint8_t)p[3]&0x3F);
+        p+=3;
+        return code<0x10000?replacement:code;
+    }
+    return replacement;
+}
+
+//把text转义后追加到out，不加引号，可以把一个字符串分成几段依次转义（比如摘要中高亮标签之间的正文）
+inline void append_json_escaped(std::string_view text,std::string* out){
+    const char* p = text.data();
+    const char* end = p+text.size();
+    while(p<end){
+        const char* run = p;
+        while(p<end&&(uint8_t)*p>=0x20&&(uint8_t)*p<0x80&&*p!='"'&&*p!='\\'){
+            p++;
+        }
+        out->append(run,p-run);
+        if(p == end){
+            break;
+        }
+        switch(*p){
+        case '"': out->append("\\\""); break;
+        case '\\': out->append("\\\\"); break;
+        case '\b': out->append("\\b"); break;
+        case '\f': out->append("\\f"); break;
+        case '\n': out->append("\\n"); break;
+        case '\r': out->append("\\r"); break;
+        case '\t': out->append("\\t"); break;
+        default:
+            if((uint8_t)*p<0x20){
+                append_json_unicode((uint8_t)*p,out);
+            }else{
+                uint32_t code = json_decode_utf8(p,end);
+                if(code<0x10000){
+                    append_json_unicode(code,out);
+                }else{
+                    code-=0x10000;
+                    append_json_unicode(0xD800+((code>>10)&0x3FF),out);
+                    append_json_unicode(0xDC00+(code&0x3FF),out);
+                }
+            }
+        }
+        p++;
+    }
+}
+
+//把text作为json字符串（带引号）追加到out
+inline void append_json_string(std::string_view text,std::string* out){
+    out->push_back('"');
+    append_json_escaped(text,out);
+    out->push_back('"');
+}
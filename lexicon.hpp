@@ -0,0 +1,352 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，词典篇
+原来的词典是std::unordered_map<std::string,posting_meta>：每个词一个堆上的节点，查找时算完哈希还要依次跳到
+桶、节点、字符串三处不相邻的内存；从快照加载时要为每个词申请一次内存；mmap模式下则在词典项上二分查找，
+每一步都要跳到字符串区比较一次。现在改成建好后不再修改的紧凑词典（lexicon）：
+1.词典项(term_entry)数组按字典序排列，词的字符串按同样的顺序连续存放在单独的字符串区里，
+  同一前缀的词挨在一起，可以按前缀或者范围枚举（二分找到起点后顺序扫描）
+2.开放寻址的哈希表，每个槽8字节：词在词典中的下标+1 和 哈希值的高32位（指纹），槽数是2的幂，装载因子不超过1/2，
+  线性探测。指纹不同的词不会去比较字符串，一次查找通常只访问 槽、词典项、字符串 各一个缓存行
+3.三个数组都是定长的POD，原样写进快照，mmap之后直接使用，从快照读入堆内存时也只是整块拷贝
+词在词典中的下标就是词id：从0开始连续的uint32_t，建好的词典中按字典序分配，联想等只需要引用词的地方都用id
+建索引的过程中还不知道全部的词，用term_interner按出现顺序分配临时的id，倒排拉链按id存放，词的字符串只保存一份
+哈希值写进了快照，lexicon_hash不能随意修改；它按本机字节序每次读8个字节，和快照中的其他整数一样，
+快照只能在同样字节序的机器上使用
+*/
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "postings.hpp"
+
+//词典项，word_offset为词在词典字符串区中的偏移，postings为压缩倒排拉链的位置
+struct term_entry{
+    uint64_t word_offset;
+    uint32_t word_size;
+    uint32_t reserved;
+    posting_meta postings;
+};
+
+//哈希槽，term为词在词典中的下标+1，0表示空槽；fingerprint为词的哈希值的高32位
+struct lexicon_slot{
+    uint32_t term;
+    uint32_t fingerprint;
+};
+
+//词典使用的哈希函数，每次处理8个字节，低位决定槽的位置，高32位作为指纹
+inline uint64_t lexicon_hash(std::string_view word){
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h = word.size()*k;
+    size_t i = 0;
+    for(;i+8<=word.size();i+=8){
+        uint64_t value;
+        memcpy(&value,word.data()+i,8);
+        h = (h^value)*k;
+        h^=h>>29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail,word.data()+i,word.size()-i);
+    h = (h^tail)*0xBF58476D1CE4E5B9ull;
+    h^=h>>31;
+    h*=0x94D049BB133111EBull;
+    h^=h>>32;
+    return h;
+}
+
+/**
+ * 不可变的词典：字词 -> 压缩倒排拉链的位置
+ * 数据可以属于词典自己（build、assign），也可以指向外部的内存（attach，mmap的快照）
+ * 建好之后所有接口都是只读的，多个线程可以同时查询
+ */
+class lexicon{
+public:
+    lexicon(){}
+    lexicon(const lexicon&) = delete;
+    lexicon& operator=(const lexicon&) = delete;
+
+    //用(词,倒排拉链位置)建立词典，terms会被按字典序排序，词不能重复
+    void build(std::vector<std::pair<std::string,posting_meta>>& terms){
+        std::sort(terms.begin(),terms.end(),[](const std::pair<std::string,posting_meta>& a,const std::pair<std::string,posting_meta>& b){
+            return a.first<b.first;
+        });
+        uint64_t string_size = 0;
+        for(auto& term:terms){
+            string_size+=term.first.size();
+        }
+        std::vector<term_entry> entries(terms.size());
+        std::string strings;
+        strings.reserve(string_size);
+        for(size_t i = 0;i<terms.size();i++){
+            term_entry& entry = entries[i];
+            memset(&entry,0,sizeof(entry));
+            entry.word_offset = strings.size();
+            entry.word_size = terms[i].first.size();
+            entry.postings = terms[i].second;
+            strings+=terms[i].first;
+        }
+        std::vector<lexicon_slot> slots(slot_count_for(entries.size()),lexicon_slot{0,0});
+        uint64_t mask = slots.size()-1;
+        for(size_t i = 0;i<entries.size();i++){
+            uint64_t h = lexicon_hash(std::string_view(strings.data()+entries[i].word_offset,entries[i].word_size));
+            uint64_t pos = h&mask;
+            while(slots[pos].term!=0){
+                pos = (pos+1)&mask;
+            }
+            slots[pos] = lexicon_slot{(uint32_t)(i+1),(uint32_t)(h>>32)};
+        }
+        owned_entries_.swap(entries);
+        owned_slots_.swap(slots);
+        owned_strings_.swap(strings);
+        use_owned();
+    }
+
+    //使用外部的数组（mmap的快照），数组需要先用validate检查过，生命周期由调用者保证
+    void attach(const term_entry* entries,uint64_t count,const lexicon_slot* slots,uint64_t slot_count,
+                const char* strings,uint64_t string_size){
+        clear();
+        entries_ = entries;
+        count_ = count;
+        slots_ = slots;
+        slot_count_ = slot_count;
+        strings_ = strings;
+        string_size_ = string_size;
+    }
+
+    //把外部的数组拷贝一份（从快照读入堆内存），数组需要先用validate检查过
+    void assign(const term_entry* entries,uint64_t count,const lexicon_slot* slots,uint64_t slot_count,
+                const char* strings,uint64_t string_size){
+        owned_entries_.assign(entries,entries+count);
+        owned_slots_.assign(slots,slots+slot_count);
+        owned_strings_.assign(strings,string_size);
+        use_owned();
+    }
+
+    void clear(){
+        std::vector<term_entry>().swap(owned_entries_);
+        std::vector<lexicon_slot>().swap(owned_slots_);
+        std::string().swap(owned_strings_);
+        entries_ = nullptr;
+        count_ = 0;
+        slots_ = nullptr;
+        slot_count_ = 0;
+        strings_ = nullptr;
+        string_size_ = 0;
+    }
+
+    static const uint32_t npos = UINT32_MAX;
+
+    //按词查找词id，找不到时返回npos
+    uint32_t find_id(std::string_view word) const {
+        if(slot_count_ == 0){
+            return npos;
+        }
+        uint64_t h = lexicon_hash(word);
+        uint32_t fingerprint = h>>32;
+        uint64_t mask = slot_count_-1;
+        uint64_t pos = h&mask;
+        for(uint64_t probe = 0;probe<slot_count_;probe++){
+            const lexicon_slot& slot = slots_[pos];
+            if(slot.term == 0){
+                return npos;
+            }
+            if(slot.fingerprint == fingerprint&&word_at(slot.term-1) == word){
+                return slot.term-1;
+            }
+            pos = (pos+1)&mask;
+        }
+        return npos;
+    }
+    //按词查找倒排拉链的位置，找不到时返回nullptr
+    const posting_meta* find(std::string_view word) const {
+        uint32_t id = find_id(word);
+        return id == npos?nullptr:&entries_[id].postings;
+    }
+
+    //词的个数，下标[0,size())按字典序排列
+    uint64_t size() const {
+        return count_;
+    }
+    std::string_view word_at(uint64_t i) const {
+        return std::string_view(strings_+entries_[i].word_offset,entries_[i].word_size);
+    }
+    const posting_meta& postings_at(uint64_t i) const {
+        return entries_[i].postings;
+    }
+
+    //第一个>=key的词的下标，[lower_bound(a),lower_bound(b))就是 a<=词<b 的所有词
+    uint64_t lower_bound(std::string_view key) const {
+        uint64_t low = 0,high = count_;
+        while(low<high){
+            uint64_t mid = low+(high-low)/2;
+            if(word_at(mid)<key){
+                low = mid+1;
+            }else{
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    //以prefix开头的所有词的下标范围[first,last)
+    std::pair<uint64_t,uint64_t> prefix_range(std::string_view prefix) const {
+        uint64_t first = lower_bound(prefix);
+        uint64_t low = first,high = count_;
+        while(low<high){
+            uint64_t mid = low+(high-low)/2;
+            if(word_at(mid).substr(0,prefix.size()) == prefix){
+                low = mid+1;
+            }else{
+                high = mid;
+            }
+        }
+        return std::make_pair(first,low);
+    }
+
+    //写快照用的原始数组
+    const term_entry* entries() const {
+        return entries_;
+    }
+    const lexicon_slot* slots() const {
+        return slots_;
+    }
+    uint64_t slot_count() const {
+        return slot_count_;
+    }
+    const char* strings() const {
+        return strings_;
+    }
+    uint64_t string_size() const {
+        return string_size_;
+    }
+
+    //count个词需要的槽数：不小于2*count的2的幂，保证至少有一个空槽
+    static uint64_t slot_count_for(uint64_t count){
+        uint64_t slots = 1;
+        while(slots<count*2+1){
+            slots*=2;
+        }
+        return slots;
+    }
+
+    //检查快照中的词典：槽数是2的幂且有空槽，槽和词典项都不越界
+    static bool validate(const term_entry* entries,uint64_t count,const lexicon_slot* slots,uint64_t slot_count,uint64_t string_size){
+        if(count>=UINT32_MAX||slot_count<=count||(slot_count&(slot_count-1))!=0){
+            return false;
+        }
+        for(uint64_t i = 0;i<slot_count;i++){
+            if(slots[i].term>count){
+                return false;
+            }
+        }
+        for(uint64_t i = 0;i<count;i++){
+            if(entries[i].word_offset+entries[i].word_size>string_size){
+                return false;
+            }
+        }
+        return true;
+    }
+private:
+    void use_owned(){
+        entries_ = owned_entries_.data();
+        count_ = owned_entries_.size();
+        slots_ = owned_slots_.data();
+        slot_count_ = owned_slots_.size();
+        strings_ = owned_strings_.data();
+        string_size_ = owned_strings_.size();
+    }
+private:
+    std::vector<term_entry> owned_entries_;
+    std::vector<lexicon_slot> owned_slots_;
+    std::string owned_strings_;
+    const term_entry* entries_ = nullptr;
+    uint64_t count_ = 0;
+    const lexicon_slot* slots_ = nullptr;
+    uint64_t slot_count_ = 0;
+    const char* strings_ = nullptr;
+    uint64_t string_size_ = 0;
+};
+
+/**
+ * 建索引时使用的可增长词典：给每个新出现的词按出现顺序分配从0开始的连续id
+ * 词连续存放在strings_里，哈希槽和lexicon一样只记录 id+1 和哈希值的高32位，
+ * 查找用string_view，不构造std::string；装载因子超过1/2时槽数翻倍，按记下的哈希值重新插入
+ */
+class term_interner{
+public:
+    static const uint32_t npos = UINT32_MAX;
+
+    //返回word的id，没有时分配一个新的；h为lexicon_hash(word)，调用者已经算过时可以直接传入
+    uint32_t intern(std::string_view word){
+        return intern(word,lexicon_hash(word));
+    }
+    uint32_t intern(std::string_view word,uint64_t h){
+        if((size()+1)*2>slots_.size()){
+            grow();
+        }
+        uint64_t mask = slots_.size()-1;
+        uint32_t fingerprint = h>>32;
+        uint64_t pos = h&mask;
+        while(slots_[pos].term!=0){
+            uint32_t id = slots_[pos].term-1;
+            if(slots_[pos].fingerprint == fingerprint&&this->word(id) == word){
+                return id;
+            }
+            pos = (pos+1)&mask;
+        }
+        uint32_t id = size();
+        slots_[pos] = lexicon_slot{id+1,fingerprint};
+        strings_.append(word.data(),word.size());
+        offsets_.push_back(strings_.size());
+        hashes_.push_back(h);
+        return id;
+    }
+    //只查找，没有时返回npos
+    uint32_t find(std::string_view word) const {
+        if(slots_.empty()){
+            return npos;
+        }
+        uint64_t h = lexicon_hash(word);
+        uint64_t mask = slots_.size()-1;
+        for(uint64_t pos = h&mask;slots_[pos].term!=0;pos = (pos+1)&mask){
+            uint32_t id = slots_[pos].term-1;
+            if(slots_[pos].fingerprint == (uint32_t)(h>>32)&&this->word(id) == word){
+                return id;
+            }
+        }
+        return npos;
+    }
+    size_t size() const {
+        return hashes_.size();
+    }
+    std::string_view word(uint32_t id) const {
+        return std::string_view(strings_.data()+offsets_[id],offsets_[id+1]-offsets_[id]);
+    }
+    //词的lexicon_hash，按哈希值给词分片时不用重新计算
+    uint64_t hash(uint32_t id) const {
+        return hashes_[id];
+    }
+private:
+    void grow(){
+        std::vector<lexicon_slot> slots(std::max<size_t>(slots_.size()*2,16),lexicon_slot{0,0});
+        uint64_t mask = slots.size()-1;
+        for(uint32_t id = 0;id<size();id++){
+            uint64_t pos = hashes_[id]&mask;
+            while(slots[pos].term!=0){
+                pos = (pos+1)&mask;
+            }
+            slots[pos] = lexicon_slot{id+1,(uint32_t)(hashes_[id]>>32)};
+        }
+        slots_.swap(slots);
+    }
+private:
+    std::string strings_;
+    std::vector<uint64_t> offsets_ = std::vector<uint64_t>(1,0);//第id个词为strings_[offsets_[id],offsets_[id+1])
+    std::vector<uint64_t> hashes_;
+    std::vector<lexicon_slot> slots_;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，监控篇
+查询慢的时候只有一行query日志，看不出时间花在分词、倒排拉链、排序、摘要还是生成json上，
+所以在搜索、建索引和解析的各个阶段计时，记进直方图，由http_server的/metrics按Prometheus文本格式输出
+1.latency_histogram：HDR风格的对数-线性直方图，单位纳秒。小于32ns的值每纳秒一个桶，
+  之后每个2的幂区间平均分成32个桶，相对误差不超过1/32，最大到2^40ns（约18分钟），更大的值记进最后一个桶
+  每个桶一个原子计数，record只做几次relaxed的fetch_add，不加锁，多个线程可以同时记录
+2.输出时把细分的桶合并成Prometheus的histogram（le为1-2-5序列，1微秒到10秒），可以用histogram_quantile按时间窗口算分位数；
+  quantile直接在细分的桶上计算进程启动以来的分位数，建索引、解析这种一次性的任务结束时打日志用
+3.stopwatch：steady_clock计时，lap返回距上一次lap（或者构造）的纳秒数
+*/
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+
+const int HISTOGRAM_SUB_BITS = 5;
+const int HISTOGRAM_MAX_BITS = 40;
+const size_t HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_BITS-HISTOGRAM_SUB_BITS+1)<<HISTOGRAM_SUB_BITS;
+
+class latency_histogram{
+public:
+    latency_histogram(){
+        for(auto& count:counts_){
+            count.store(0,std::memory_order_relaxed);
+        }
+    }
+    latency_histogram(const latency_histogram&) = delete;
+    latency_histogram& operator=(const latency_histogram&) = delete;
+
+    void record(uint64_t ns){
+        counts_[bucket_of(ns)].fetch_add(1,std::memory_order_relaxed);
+        sum_.fetch_add(ns,std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while(ns>max&&!max_.compare_exchange_weak(max,ns,std::memory_order_relaxed)){
+        }
+    }
+
+    //记录的次数，读取时各个桶不是同一时刻的值，和sum可能差几次正在进行的记录
+    uint64_t count() const {
+        uint64_t total = 0;
+        for(auto& count:counts_){
+            total+=count.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+    uint64_t sum() const {
+        return sum_.load(std::memory_order_relaxed);
+    }
+    uint64_t max() const {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    //第q分位（0<=q<=1）所在的桶的上界，不超过记录过的最大值，没有记录时为0
+    uint64_t quantile(double q) const {
+        uint64_t total = count();
+        if(total == 0){
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(q*total+0.5);
+        rank = std::min(std::max<uint64_t>(rank,1),total);
+        uint64_t seen = 0;
+        for(size_t b = 0;b<HISTOGRAM_BUCKETS;b++){
+            seen+=counts_[b].load(std::memory_order_relaxed);
+            if(seen>=rank){
+                return std::min(bucket_upper(b),max());
+            }
+        }
+        return max();
+    }
+
+    //第b个桶的记录次数
+    uint64_t bucket_count(size_t b) const {
+        return counts_[b].load(std::memory_order_relaxed);
+    }
+
+    static size_t bucket_of(uint64_t ns){
+        const uint64_t sub = 1ull<<HISTOGRAM_SUB_BITS;
+        if(ns<sub){
+            return ns;
+        }
+        if(ns>>HISTOGRAM_MAX_BITS){
+            return HISTOGRAM_BUCKETS-1;
+        }
+        int shift = 63-__builtin_clzll(ns)-HISTOGRAM_SUB_BITS;
+        return ((size_t)(shift+1)<<HISTOGRAM_SUB_BITS)+(size_t)((ns>>shift)-sub);
+    }
+    //第b个桶中最大的值
+    static uint64_t bucket_upper(size_t b){
+        const uint64_t sub = 1ull<<HISTOGRAM_SUB_BITS;
+        if(b<sub){
+            return b;
+        }
+        int shift = (b>>HISTOGRAM_SUB_BITS)-1;
+        uint64_t mantissa = (b&(sub-1))+sub;
+        return ((mantissa+1)<<shift)-1;
+    }
+private:
+    std::atomic<uint64_t> counts_[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+class stopwatch{
+public:
+    stopwatch()
+    :last_(std::chrono::steady_clock::now())
+    {}
+    uint64_t lap(){
+        auto now = std::chrono::steady_clock::now();
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now-last_).count();
+        last_ = now;
+        return ns;
+    }
+private:
+    std::chrono::steady_clock::time_point last_;
+};
+
+/*
+下面是Prometheus文本格式的输出，每个指标族先写一次HELP和TYPE，再写各个label的值
+label为空时不带label，否则为 {label}，比如 stage="segment"
+*/
+inline void append_metric_header(std::string* out,const char* name,const char* type,const char* help){
+    *out+="# HELP ";
+    *out+=name;
+    *out+=' ';
+    *out+=help;
+    *out+="\n# TYPE ";
+    *out+=name;
+    *out+=' ';
+    *out+=type;
+    *out+='\n';
+}
+
+inline void append_metric_text(std::string* out,const char* name,const char* suffix,const std::string& label,const char* value){
+    *out+=name;
+    *out+=suffix;
+    if(!label.empty()){
+        *out+='{';
+        *out+=label;
+        *out+='}';
+    }
+    *out+=' ';
+    *out+=value;
+    *out+='\n';
+}
+inline void append_metric_value(std::string* out,const char* name,const char* suffix,const std::string& label,double value){
+    char buff[64];
+    snprintf(buff,sizeof(buff),"%.9g",value);
+    append_metric_text(out,name,suffix,label,buff);
+}
+//计数按整数输出，不会因为超过double的有效位数而失真
+inline void append_metric_value(std::string* out,const char* name,const char* suffix,const std::string& label,uint64_t value){
+    append_metric_text(out,name,suffix,label,std::to_string(value).c_str());
+}
+
+//一个histogram的桶、总和与次数，单位换算成秒
+inline void append_histogram(std::string* out,const char* name,const std::string& label,const latency_histogram& histogram){
+    static const uint64_t bounds[] = {
+        1000,2000,5000,10000,20000,50000,100000,200000,500000,
+        1000000,2000000,5000000,10000000,20000000,50000000,100000000,200000000,500000000,
+        1000000000,2000000000,5000000000,10000000000
+    };
+    std::string bucket_label = label.empty()?std::string():label+",";
+    //一遍累加细分的桶，按桶的上界归到第一个不小于它的le，各个le和+Inf用的是同一份计数
+    uint64_t count = 0;
+    size_t b = 0;
+    for(uint64_t bound:bounds){
+        for(;b<HISTOGRAM_BUCKETS&&latency_histogram::bucket_upper(b)<=bound;b++){
+            count+=histogram.bucket_count(b);
+        }
+        char le[32];
+        snprintf(le,sizeof(le),"le=\"%g\"",bound/1e9);
+        append_metric_value(out,name,"_bucket",bucket_label+le,count);
+    }
+    for(;b<HISTOGRAM_BUCKETS;b++){
+        count+=histogram.bucket_count(b);
+    }
+    append_metric_value(out,name,"_bucket",bucket_label+"le=\"+Inf\"",count);
+    append_metric_value(out,name,"_sum",label,histogram.sum()/1e9);
+    append_metric_value(out,name,"_count",label,count);
+}
@@ -16,87 +16,417 @@
 内容解析与预处理的步骤：
 1.提取出所有HTML的文件路径. 提示使用boost库的文件系统，更方便/头文件 #include <boost/filesystem.hpp>
 2.根据提取出的文件路径读取文件，将html文件内容解析，解析为title、content、url。
-用结构体保存解析内容。同时用一个数组存储该结构体。
-3.将保存结构体数组消息保存到raw.txt文件中，注意结构体内属性的分隔符为\3 不同html的分隔符为\n
+3.将解析结果保存到raw.txt文件中，注意结构体内属性的分隔符为\3 不同html的分隔符为\n
+
+多线程流水线：
+  主线程遍历目录，把(序号,文件路径)放进有界队列
+  多个解析线程从队列中取路径，每个文件只读一次，读到线程自己复用的缓冲区里，一遍解析出title和content
+  解析好的记录交给ordered_writer，按序号顺序写入raw.txt，输出和单线程解析完全一致
+  ordered_writer只允许序号领先已写出记录一个窗口以内的记录等待写出，内存占用与文件总数无关
+
+全量解析会重写raw.txt（不再追加，重复运行不会产生重复的文档），同时记录每个文件的大小、修改时间和内容哈希(manifest.txt)
+增量解析(-i)：和上次的manifest比较，大小和修改时间都没变的文件直接跳过，变了的再比较内容哈希，
+只有新增、修改、删除的文件才会被解析，变更按 A/U/D 追加到变更日志delta.txt（格式见index.hpp），
+同时把变更合并进raw.txt，保证raw.txt始终是完整的语料，随时可以用来全量重建索引
+每个文件读取（含计算哈希）和解析的耗时记进直方图，结束时打一行日志，并按Prometheus文本格式写到parser_metrics.prom，
+http_server的/metrics会把它附在后面输出
+用法：./parser [-i] [解析线程数，默认为机器核数]
  */
 #include <boost/filesystem.hpp>
 #include <fstream>
 #include<iostream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <algorithm>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctime>
 #include"Log.hpp"
+#include "tools.hpp"
+#include "metrics.hpp"
 
 //定义html存储路径、最后内容的保存位置
 const std::string html_src_path = "data/input";
 const std::string html_save_path = "data/raw_html/raw.txt";
+//增量解析用到的文件清单和变更日志
+const std::string manifest_path = "data/raw_html/manifest.txt";
+const std::string delta_path = "data/raw_html/delta.txt";
+//最近一次解析的耗时统计
+const std::string metrics_path = "data/raw_html/parser_metrics.prom";
 
-//定义结构体
-class file_content{
-public:
-    file_content(){}
-    file_content(std::string title,std::string content,std::string url)
-        :title_(title)
-        ,content_(content)
-        ,url_(url)
-        {}
-public:
-    std::string title_;
-    std::string content_;
-    std::string url_;
-};
 /*
  *:cosnt &表示输入
  *:* 表示输出
  *:& 表示输入输出
 */
+
+//文件的大小、修改时间和内容哈希，增量解析时用来判断文件是否变化
+struct file_stat{
+    uint64_t size = 0;
+    int64_t mtime = 0;//纳秒
+    uint64_t hash = 0;
+};
+//html路径 -> 上次解析时的文件状态
+using file_manifest = std::unordered_map<std::string,file_stat>;
+
+//一个待解析的html文件，seq为它在目录遍历中的顺序，skip表示大小和修改时间都没变，不需要再读
+struct parse_task{
+    uint64_t seq = 0;
+    std::string path;
+    file_stat stat;
+    bool skip = false;
+};
+
+//解析结果，changed为false时表示内容没有变化，record为空
+struct parse_result{
+    std::string path;
+    file_stat stat;
+    std::string record;
+    bool changed = true;
+};
+
+//增量解析得到的一条变更，op为A(新增)/U(修改)/D(删除)
+struct html_change{
+    char op;
+    std::string url;
+    std::string record;
+};
+
+//一次解析的耗时统计，解析线程同时记录
+struct parse_metrics{
+    latency_histogram read;//读取一个文件并计算内容哈希
+    latency_histogram parse;//解析一个文件
+    std::atomic<uint64_t> skipped{0};//增量模式下大小和修改时间都没变、没有读取的文件
+};
+
+/**
+ * 按序号顺序处理解析结果
+ * 解析线程完成的先后是乱序的，先完成的结果暂存在pending中，等前面的结果都处理完后再交给sink
+ * 序号超过next_+window_的结果会阻塞等待，保证pending中最多只有window_条结果
+ * 序号为next_的结果永远不会被阻塞，所以不会死锁
+ */
+class ordered_writer{
+public:
+    ordered_writer(std::function<void(parse_result&)> sink,size_t window)
+    :sink_(std::move(sink))
+    ,window_(window)
+    {}
+    void put(uint64_t seq,parse_result result){
+        std::unique_lock<std::mutex> lock(mtx_);
+        cond_.wait(lock,[this,seq]{ return seq<next_+window_; });
+        pending_.emplace(seq,std::move(result));
+        bool advanced = false;
+        for(auto iter = pending_.begin();iter!=pending_.end()&&iter->first == next_;iter = pending_.erase(iter)){
+            sink_(iter->second);
+            next_++;
+            advanced = true;
+        }
+        if(advanced){
+            cond_.notify_all();
+        }
+    }
+private:
+    std::function<void(parse_result&)> sink_;
+    size_t window_;
+    uint64_t next_ = 0;
+    std::map<uint64_t,parse_result> pending_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+};
+
+/*
+遍历目标路径下的html文件，每找到一个就交给回调
+参数：输入参数目标路径，找到html文件时的回调
+*/
+template<class Emit>
+bool extract_html(const std::string&src_path,Emit emit);
+
 /*
-提取目标路径下的html文件路径
-参数：输入参数目标路径，输入输出参数带回html路径的数组
+解析一个已经读进buffer的html文件，生成写入raw.txt的一行记录
+需要的参数有：html路径，文件内容，输出的记录
 */
-bool extract_html(const std::string&src_path,std::vector<std::string>&htmls);
+void parse_html(const std::string& file_path,const std::string& buffer,std::string* record);
 
 /*
-解析html文件
-需要的参数有：存储了html路径的数组，存储了file_content的数组（输入输出）
+多线程解析流水线，old_manifest不为空时为增量模式：大小和修改时间没变的文件不读，内容哈希没变的文件不解析
+每个文件的解析结果按目录遍历顺序交给sink，返回找到的html文件数，遍历失败返回-1
 */
-bool parse_html(const std::vector<std::string>&htmls,std::vector<file_content>&file_contents);
+int64_t run_parse(int thread_num,const file_manifest* old_manifest,parse_metrics* metrics,std::function<void(parse_result&)> sink);
+//打印并保存一次解析的耗时统计，mode为"full"或"incremental"
+void report_metrics(const parse_metrics& metrics,const char* mode,int64_t file_count,uint64_t run_ns);
 
-/**
- * 保存所有文件的file_content的内容
- * 需要的参数：file_contents
- */
-bool save_file(const std::vector<file_content>&file_contents);
+//全量解析：重写raw.txt和manifest
+int parse_all(int thread_num);
+//增量解析：只解析变化的文件，变更追加到变更日志，并据此更新raw.txt和manifest
+int parse_incremental(int thread_num,const file_manifest& old_manifest);
 
-bool get_title(const std::string& file_path,std::string& title);
-bool get_content(const std::string& file_path,std::string& content);
+//一遍扫描同时提取title和content，文件为空时返回false，没有找到<title>...</title>时title_found为false
+bool get_title_content(std::string_view file_all,std::string& title,std::string& content,bool* title_found);
 bool get_url(const std::string& file_path,std::string& url);
 
-std::string get_file_all(const std::string file_path);
+bool read_file(const std::string& file_path,std::string& buffer);
+bool get_file_stat(const std::string& file_path,file_stat* stat);
+uint64_t hash_content(std::string_view data);
+bool load_manifest(const std::string& path,file_manifest* manifest);
+bool save_manifest(const std::string& path,const file_manifest& manifest);
+bool rewrite_raw(const std::vector<html_change>& changes);
 
-int main()
+int main(int argc,char* argv[])
 {
     able_save();
-    std::vector<std::string> htmls;
-    if(!extract_html(html_src_path,htmls)){
+    bool incremental = false;
+    int thread_num = 0;
+    for(int i = 1;i<argc;i++){
+        if(std::string(argv[i]) == "-i"){
+            incremental = true;
+        }else{
+            thread_num = atoi(argv[i]);
+        }
+    }
+    if(thread_num<=0){
+        thread_num = std::max(1u,std::thread::hardware_concurrency());
+    }
+    if(incremental){
+        file_manifest old_manifest;
+        if(load_manifest(manifest_path,&old_manifest)){
+            return parse_incremental(thread_num,old_manifest);
+        }
+        LOG(WARNING,"%s不存在，改为全量解析",manifest_path.c_str());
+    }
+    return parse_all(thread_num);
+}
+
+int64_t run_parse(int thread_num,const file_manifest* old_manifest,parse_metrics* metrics,std::function<void(parse_result&)> sink){
+    block_queue<parse_task> tasks(thread_num*16);
+    ordered_writer writer(std::move(sink),thread_num*64);
+    std::vector<std::thread> workers;
+    for(int i = 0;i<thread_num;i++){
+        workers.emplace_back([&tasks,&writer,old_manifest,metrics]{
+            std::string buffer;//每个线程复用的读缓冲区
+            parse_task task;
+            while(tasks.pop(&task)){
+                parse_result result;
+                result.stat = task.stat;
+                if(task.skip){
+                    result.stat = old_manifest->at(task.path);
+                    result.changed = false;
+                    metrics->skipped.fetch_add(1,std::memory_order_relaxed);
+                }else{
+                    stopwatch timer;
+                    if(!read_file(task.path,buffer)){
+                        buffer.clear();
+                    }
+                    result.stat.hash = hash_content(buffer);
+                    metrics->read.record(timer.lap());
+                    if(old_manifest){
+                        auto iter = old_manifest->find(task.path);
+                        result.changed = iter == old_manifest->end()||iter->second.hash!=result.stat.hash;
+                    }
+                    if(result.changed){
+                        parse_html(task.path,buffer,&result.record);
+                        metrics->parse.record(timer.lap());
+                    }
+                }
+                result.path = std::move(task.path);
+                writer.put(task.seq,std::move(result));
+            }
+        });
+    }
+    uint64_t file_count = 0;
+    bool ok = extract_html(html_src_path,[&tasks,&file_count,old_manifest](std::string path){
+        parse_task task;
+        task.seq = file_count++;
+        get_file_stat(path,&task.stat);
+        if(old_manifest){
+            auto iter = old_manifest->find(path);
+            task.skip = iter!=old_manifest->end()&&iter->second.size == task.stat.size&&iter->second.mtime == task.stat.mtime;
+        }
+        task.path = std::move(path);
+        tasks.push(std::move(task));
+    });
+    tasks.close();
+    for(std::thread& t:workers){
+        t.join();
+    }
+    if(!ok){
+        return -1;
+    }
+    return file_count;
+}
+
+int parse_all(int thread_num){
+    //先写临时文件再rename，重复运行不会把内容追加到旧的raw.txt后面
+    std::string tmp_path = html_save_path+".tmp";
+    std::ofstream ofm(tmp_path,std::ios::out|std::ios::trunc);
+    if(!ofm.is_open()){
+        LOG(FATAL,"%s打开失败",tmp_path.c_str());
+        return 3;
+    }
+    file_manifest manifest;
+    parse_metrics metrics;
+    stopwatch run_timer;
+    int64_t file_count = run_parse(thread_num,nullptr,&metrics,[&ofm,&manifest](parse_result& result){
+        ofm.write(result.record.data(),result.record.size());
+        manifest[result.path] = result.stat;
+    });
+    if(file_count<0){
         LOG(FATAL,"提取html文件路径失败");
-        exit(1);
+        return 1;
     }
-    LOG(INFO,"提取html文件路径成功");
-    std::vector<file_content> file_contents;
-    if(!parse_html(htmls,file_contents)){
-        LOG(FATAL,"解析html文件失败");
-        exit(2);
+    if(file_count == 0){
+        LOG(FATAL,"解析html文件失败，没有找到html文件");
+        return 2;
     }
-    LOG(INFO,"解析html文件成功");
-    if(!save_file(file_contents)){
+    LOG(INFO,"%d个线程解析%lld个html文件成功",thread_num,(long long)file_count);
+    report_metrics(metrics,"full",file_count,run_timer.lap());
+    ofm.close();
+    if(!ofm||std::rename(tmp_path.c_str(),html_save_path.c_str())!=0){
         LOG(FATAL,"存储html内容失败");
-        exit(3);
+        return 3;
     }
     LOG(INFO,"存储html内容成功");
+    if(!save_manifest(manifest_path,manifest)){
+        LOG(WARNING,"%s保存失败，下次只能全量解析",manifest_path.c_str());
+    }
+    return 0;
+}
+
+int parse_incremental(int thread_num,const file_manifest& old_manifest){
+    file_manifest manifest;
+    std::vector<html_change> changes;
+    parse_metrics metrics;
+    stopwatch run_timer;
+    int64_t file_count = run_parse(thread_num,&old_manifest,&metrics,[&manifest,&changes,&old_manifest](parse_result& result){
+        manifest[result.path] = result.stat;
+        if(result.changed){
+            std::string url;
+            get_url(result.path,url);
+            changes.push_back(html_change{old_manifest.count(result.path)?'U':'A',url,std::move(result.record)});
+        }
+    });
+    if(file_count<0){
+        LOG(FATAL,"提取html文件路径失败");
+        return 1;
+    }
+    //上次有、这次没有的文件就是被删除了
+    for(auto& item:old_manifest){
+        if(!manifest.count(item.first)){
+            std::string url;
+            get_url(item.first,url);
+            changes.push_back(html_change{'D',url,""});
+        }
+    }
+    LOG(INFO,"%d个线程增量解析%lld个html文件，变更%llu个",thread_num,(long long)file_count,(unsigned long long)changes.size());
+    report_metrics(metrics,"incremental",file_count,run_timer.lap());
+    if(!changes.empty()){
+        //先把变更合并进raw.txt，再追加变更日志：合并失败时日志和manifest都不更新，下次增量解析会重新发现这些变更；
+        //日志追加失败时raw.txt已经包含了变更，重新合并同样的变更结果不变
+        if(!rewrite_raw(changes)){
+            LOG(FATAL,"存储html内容失败");
+            return 3;
+        }
+        //变更日志是追加写的，索引按上次应用到的位置继续读
+        std::ofstream delta(delta_path,std::ios::out|std::ios::app|std::ios::binary);
+        if(!delta.is_open()){
+            LOG(FATAL,"%s打开失败",delta_path.c_str());
+            return 3;
+        }
+        for(const html_change& change:changes){
+            delta<<change.op<<'\3';
+            if(change.op == 'D'){
+                delta<<change.url<<'\n';
+            }else{
+                delta<<change.record;
+            }
+        }
+        delta.close();
+        if(!delta){
+            LOG(FATAL,"%s写入失败",delta_path.c_str());
+            return 3;
+        }
+    }
+    //即使没有变更也要保存，记录下新的修改时间，下次就不用再读这些文件了
+    if(!save_manifest(manifest_path,manifest)){
+        LOG(WARNING,"%s保存失败",manifest_path.c_str());
+    }
+    LOG(INFO,"增量解析完成");
     return 0;
 }
 
-bool extract_html(const std::string&src_path,std::vector<std::string>&htmls){
+void report_metrics(const parse_metrics& metrics,const char* mode,int64_t file_count,uint64_t run_ns){
+    LOG(INFO,"解析耗时%.2fs，读取%llu个文件：p50 %.1fus，p99 %.1fus，最长%.2fms；解析%llu个文件：p50 %.1fus，p99 %.1fus，最长%.2fms",
+        run_ns/1e9,(unsigned long long)metrics.read.count(),metrics.read.quantile(0.5)/1e3,metrics.read.quantile(0.99)/1e3,metrics.read.max()/1e6,
+        (unsigned long long)metrics.parse.count(),metrics.parse.quantile(0.5)/1e3,metrics.parse.quantile(0.99)/1e3,metrics.parse.max()/1e6);
+    std::string text;
+    append_metric_header(&text,"yui_parser_file_seconds","histogram","Time to read (and hash) or parse one html file in the last parser run.");
+    append_histogram(&text,"yui_parser_file_seconds","stage=\"read\"",metrics.read);
+    append_histogram(&text,"yui_parser_file_seconds","stage=\"parse\"",metrics.parse);
+    std::string label = std::string("mode=\"")+mode+"\"";
+    append_metric_header(&text,"yui_parser_files","gauge","Html files found by the last parser run.");
+    append_metric_value(&text,"yui_parser_files","",label,(uint64_t)file_count);
+    append_metric_header(&text,"yui_parser_skipped_files","gauge","Files skipped because their size and mtime did not change.");
+    append_metric_value(&text,"yui_parser_skipped_files","",label,metrics.skipped.load());
+    append_metric_header(&text,"yui_parser_run_seconds","gauge","Wall time of the last parser run.");
+    append_metric_value(&text,"yui_parser_run_seconds","",label,run_ns/1e9);
+    append_metric_header(&text,"yui_parser_last_run_timestamp_seconds","gauge","Unix time when the last parser run finished.");
+    append_metric_value(&text,"yui_parser_last_run_timestamp_seconds","",label,(uint64_t)time(nullptr));
+    //先写临时文件再rename，http_server不会读到写了一半的文件
+    std::string tmp_path = metrics_path+".tmp";
+    std::ofstream ofm(tmp_path,std::ios::out|std::ios::trunc|std::ios::binary);
+    ofm.write(text.data(),text.size());
+    ofm.close();
+    if(!ofm||std::rename(tmp_path.c_str(),metrics_path.c_str())!=0){
+        LOG(WARNING,"%s保存失败",metrics_path.c_str());
+    }
+}
+
+//把变更合并进raw.txt：修改的记录原地替换，删除的记录去掉，新增的记录追加到末尾，只顺序读写一遍文件，不需要重新解析html
+bool rewrite_raw(const std::vector<html_change>& changes){
+    std::unordered_map<std::string,const html_change*> by_url;
+    for(const html_change& change:changes){
+        by_url[change.url] = &change;
+    }
+    std::ifstream ifm(html_save_path,std::ios::in|std::ios::binary);
+    std::string tmp_path = html_save_path+".tmp";
+    std::ofstream ofm(tmp_path,std::ios::out|std::ios::trunc|std::ios::binary);
+    if(!ofm.is_open()){
+        return false;
+    }
+    std::string line;
+    while(std::getline(ifm,line)){
+        std::string url = line.substr(line.rfind('\3')+1);
+        auto iter = by_url.find(url);
+        if(iter == by_url.end()){
+            ofm<<line<<'\n';
+            continue;
+        }
+        if(iter->second->op!='D'){
+            ofm<<iter->second->record;
+        }
+        by_url.erase(iter);
+    }
+    for(const html_change& change:changes){
+        auto iter = by_url.find(change.url);
+        if(iter!=by_url.end()&&iter->second == &change&&change.op!='D'){
+            ofm<<change.record;
+        }
+    }
+    ofm.close();
+    if(!ofm){
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return std::rename(tmp_path.c_str(),html_save_path.c_str()) == 0;
+}
+
+template<class Emit>
+bool extract_html(const std::string&src_path,Emit emit){
     /**
      * 利用boost库中的文件系统操作，namespace fs = boost::filesystem 简化操作
      * 具体操作为，先定义一个path对象（fs::path xxx），检查后，在定义一个空迭代器，用于判断递归的结束(fs::recursive_directory_iterator end)
@@ -112,7 +442,6 @@ bool extract_html(const std::string&src_path,std::vector<std::string>&htmls){
     }
     //定义迭代器
     fs::recursive_directory_iterator end;
-    // int num = 0;
     for(fs::recursive_directory_iterator iter(root_path);iter!=end;++iter){
         //筛选出满足条件的html普通文件
         if(!fs::is_regular_file(*iter)){
@@ -122,101 +451,156 @@ bool extract_html(const std::string&src_path,std::vector<std::string>&htmls){
             continue;//跳过
         }
 
-        //未跳过的文件都是满足要求的,存储到htmls中
-        htmls.push_back(iter->path().string());
-        // if(num++<10)
-        // LOG(DEBUG,"%s",iter->path().string().c_str());
+        //未跳过的文件都是满足要求的，交给解析线程
+        emit(iter->path().string());
     }
     return true;
 }
 
-
-
-bool parse_html(const std::vector<std::string>&htmls,std::vector<file_content>&file_contents){
+void parse_html(const std::string& file_path,const std::string& buffer,std::string* record){
     /**
-     * 解析html文件，分3步：
-     * 提取title
-     * 提取content
+     * 解析html文件，分2步：
+     * 一遍扫描提取title和content（扫描时去掉换行，和原来按行读取再拼接的结果一致，记录中不会出现换行）
      * 构建url
      */
-    if(htmls.empty()){
-        LOG(WARNING,"htmls内容为空");
+    std::string title,content,url;
+    bool title_found = false;
+    if(!get_title_content(buffer,title,content,&title_found)){
+        LOG(WARNING,"%s文件content提取失败",file_path.c_str());
+    }
+    if(!title_found){
+        LOG(WARNING,"%s文件title提取失败",file_path.c_str());
+    }
+    if(!get_url(file_path,url)){
+        LOG(WARNING,"%s文件url构建失败",file_path.c_str());
+    }
+    //分隔符
+    const char SEP = '\3';
+    record->clear();
+    record->reserve(title.size()+content.size()+url.size()+3);
+    *record+=title;
+    *record+=SEP;
+    *record+=content;
+    *record+=SEP;
+    *record+=url;
+    *record+='\n';
+}
+
+//把整个文件读进buffer，buffer在同一个线程的多次调用之间复用，不会反复申请内存
+bool read_file(const std::string& file_path,std::string& buffer){
+    buffer.clear();
+    int fd = open(file_path.c_str(),O_RDONLY);
+    if(fd<0){
         return false;
     }
-    // int num = 0;
-    for(const std::string& file_path:htmls){
-        std::string title,content,url;
-        if(!get_title(file_path,title)){
-            LOG(WARNING,"%s文件title提取失败",file_path.c_str());
-        }
-        if(!get_content(file_path,content)){
-            LOG(WARNING,"%s文件content提取失败",file_path.c_str());
-        }
-        if(!get_url(file_path,url)){
-            LOG(WARNING,"%s文件url构建失败",file_path.c_str());
+    struct stat st;
+    if(fstat(fd,&st)<0){
+        close(fd);
+        return false;
+    }
+    buffer.resize(st.st_size);
+    size_t done = 0;
+    while(done<buffer.size()){
+        ssize_t n = read(fd,&buffer[done],buffer.size()-done);
+        if(n<=0){
+            break;
         }
-        // if(num++>10) break;
-        file_content item(title,content,url);
-        file_contents.push_back(item);
+        done+=n;
     }
+    close(fd);
+    buffer.resize(done);
     return true;
 }
 
-std::string get_file_all(const std::string file_path){
-    std::ifstream ifs(file_path,std::ios::in);//读取
-    if(!ifs.is_open()){
-        return "";
+//文件的大小和修改时间
+bool get_file_stat(const std::string& file_path,file_stat* stat){
+    struct stat st;
+    if(::stat(file_path.c_str(),&st)<0){
+        return false;
     }
-    std::string tmp,res;
-    while(getline(ifs,tmp)){ //按行读取文件内容
-        res+=tmp;
+    stat->size = st.st_size;
+    stat->mtime = (int64_t)st.st_mtim.tv_sec*1000000000+st.st_mtim.tv_nsec;
+    return true;
+}
+
+//FNV-1a 64位哈希，只用来判断文件内容有没有变化
+uint64_t hash_content(std::string_view data){
+    uint64_t hash = 14695981039346656037ull;
+    for(unsigned char c:data){
+        hash^=c;
+        hash*=1099511628211ull;
     }
-    return res;
+    return hash;
 }
 
-bool get_title(const std::string& file_path,std::string& title){
-    //读取文件内容
-    std::string file_all = get_file_all(file_path);
-    // LOG(DEBUG,"%s",file_all.c_str());
-    if(file_all.empty()){
+//manifest每行一个文件：路径\3大小\3修改时间\3内容哈希
+bool load_manifest(const std::string& path,file_manifest* manifest){
+    std::ifstream ifm(path,std::ios::in);
+    if(!ifm.is_open()){
         return false;
     }
-    //开始提取title内容
-    //<title> xxx </title>
-    size_t sz = std::string("<title>").size();
-    size_t begin = file_all.find("<title>");
-    if(begin == std::string::npos){
-        return false;
+    std::string line;
+    std::vector<std::string> res;
+    while(std::getline(ifm,line)){
+        split_string(line,res,"\3");
+        if(res.size()!=4){
+            LOG(WARNING,"%s格式错误",path.c_str());
+            continue;
+        }
+        file_stat& stat = (*manifest)[res[0]];
+        stat.size = std::stoull(res[1]);
+        stat.mtime = std::stoll(res[2]);
+        stat.hash = std::stoull(res[3]);
     }
-    size_t end = file_all.find("</title>");
-    if(end == std::string::npos){
+    return true;
+}
+
+bool save_manifest(const std::string& path,const file_manifest& manifest){
+    std::string tmp_path = path+".tmp";
+    std::ofstream ofm(tmp_path,std::ios::out|std::ios::trunc);
+    if(!ofm.is_open()){
         return false;
     }
-    if(begin>=end){
+    for(auto& item:manifest){
+        ofm<<item.first<<'\3'<<item.second.size<<'\3'<<item.second.mtime<<'\3'<<item.second.hash<<'\n';
+    }
+    ofm.close();
+    if(!ofm){
+        std::remove(tmp_path.c_str());
         return false;
     }
-    size_t len = end-begin-sz;
-    title = file_all.substr(begin+sz,len);
-    // LOG(DEBUG,"%s",title.c_str());
-    return true;
-    
+    return std::rename(tmp_path.c_str(),path.c_str()) == 0;
 }
-bool get_content(const std::string& file_path,std::string& content){
-    //读取文件内容
-    std::string file_all = get_file_all(file_path);
+
+bool get_title_content(std::string_view file_all,std::string& title,std::string& content,bool* title_found){
+    *title_found = false;
     if(file_all.empty()){
         return false;
     }
     content.clear();
+    content.reserve(file_all.size());
     //提取内容，比较难，html文件中有众多的标签。
     //<>xxx<> 为了提取出内容，就必须要知道，目前属于什么状态(遍历提取需要的字符)
     //可以写一个简易的状态机，一共两种状态：标签状态(label)、内容状态
+    //title为第一个<title>和第一个</title>之间的内容，遇到'<'时顺便检查是不是这两个标签
+    const std::string_view open_tag = "<title>";
+    const std::string_view close_tag = "</title>";
+    size_t title_begin = std::string_view::npos;
+    size_t title_end = std::string_view::npos;
     enum State{
         LABEL,
         BODY
     };
     State state = LABEL;
-    for(char c:file_all){
+    for(size_t i = 0;i<file_all.size();i++){
+        char c = file_all[i];
+        if(c == '<'){
+            if(title_begin == std::string_view::npos&&file_all.compare(i,open_tag.size(),open_tag) == 0){
+                title_begin = i+open_tag.size();
+            }else if(title_end == std::string_view::npos&&file_all.compare(i,close_tag.size(),close_tag) == 0){
+                title_end = i;
+            }
+        }
         if(state == LABEL){
             if(c == '>'){
                 state = BODY;
@@ -224,13 +608,18 @@ bool get_content(const std::string& file_path,std::string& content){
         }else if(state == BODY){
             if(c == '<'){
                 state = LABEL;
-            }else{
-                if(c == '\n') c = ' ';
+            }else if(c!='\n'){
+                //和原来按行读取再拼接的结果一致，换行直接去掉
                 content+=c;
             }
         }
     }
-    // LOG(DEBUG,"%d内容：%s",file_all.size(),content.c_str());
+    //<title> xxx </title>，</title>出现在<title>之前时算作提取失败
+    if(title_begin!=std::string_view::npos&&title_end!=std::string_view::npos&&title_begin<=title_end){
+        title.assign(file_all.data()+title_begin,title_end-title_begin);
+        title.erase(std::remove(title.begin(),title.end(),'\n'),title.end());
+        *title_found = true;
+    }
     return true;
 }
 bool get_url(const std::string& file_path,std::string& url){
@@ -241,18 +630,3 @@ bool get_url(const std::string& file_path,std::string& url){
     url = head+tail;
     return true;
 }
-
-bool save_file(const std::vector<file_content>&file_contents){
-    //分隔符
-    const std::string SEP = "\3";
-    std::ofstream ofm(html_save_path,std::ios::app);
-    if(!ofm.is_open()){
-        return false;
-    }
-    for(const file_content& item:file_contents){
-        std::string tmp = item.title_+SEP+item.content_+SEP+item.url_+'\n';
-        ofm.write(tmp.c_str(),tmp.size());
-    }
-    ofm.close();
-    return true;
-}
\ No newline at end of file
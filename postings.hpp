@@ -0,0 +1,446 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，倒排拉链压缩篇
+原来每个倒排元素是 uint64_t id + int weight，一个元素16字节，词频高的词会占掉大量内存。
+压缩的思路：
+1.倒排拉链按文档id升序排列，相邻id之间做差（delta），差值一般很小，再用varint编码，大多数只占1个字节
+2.权重量化为1个字节：小于128的权重原样保存，更大的权重按1.05的等比区间取近似值
+3.每POSTING_BLOCK_SIZE个元素分成一块，块表(posting_block)记录块内最后一个id、块数据的偏移以及块内最大权重，
+  解码时一次解出一整块，跳表查找(next_geq)可以直接按块跳过
+4.每个词还记录整条倒排拉链的最大权重，块内最大权重和整条拉链的最大权重是WAND/Block-Max WAND剪枝用的上界
+5.保存的权重是BM25中只和文档有关的部分，词的idf记在posting_meta里（见bm25.hpp），
+  posting_iterator返回的权重、最大权重都已经乘上了idf
+块数据布局：[count个varint编码的id差值][count个字节的量化权重]
+块内第一个元素的差值相对于上一块的last_id（第一块相对于0）
+
+文档id在块中按32位保存，单个索引最多支持2^32个文档
+
+posting_list_view 是一个词的压缩倒排拉链的只读视图，可以指向堆内存也可以指向mmap的快照
+posting_iterator 按块解码，Searcher用它遍历倒排拉链，也可以用next_geq跳到指定id，
+用shallow_seek在不解码的情况下查看某个id所在块的最大权重
+
+位置信息（可选）：
+每个(词,文档)的位置信息编码成一段独立的字节串，和倒排拉链分开存放，普通查询遍历倒排拉链时不会读到它，
+只有短语匹配、邻近度加分和生成摘要时才按文档取出来：
+  [title中出现次数][content中出现次数][title中的序号差值...][content中的(序号差值,字节偏移差值)...]  全部是varint
+序号是词在字段分词结果中的位置（见JiebaUtil::CutTokens），字节偏移是词在content中的起始位置
+一个词所有文档的位置信息按倒排拉链的顺序以 [长度][字节串] 依次存放，块的划分和倒排拉链一致，
+每块记录块内第一个文档的位置信息相对该词起点的偏移，查找时先定位到块，再按长度跳过块内前面的文档
+*/
+
+#include <vector>
+#include <string>
+#include <iterator>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+//每块的倒排元素个数
+const uint32_t POSTING_BLOCK_SIZE = 128;
+
+//块表项，offset为块数据相对于该词数据起点的偏移，max_code为块内最大权重的量化编码
+struct posting_block{
+    uint32_t last_id;
+    uint32_t offset;
+    uint16_t count;
+    uint8_t max_code;
+    uint8_t reserved;
+};
+
+//一个词的倒排拉链在块表和数据区中的位置，max_weight为整条拉链的最大权重（没有乘idf）
+//idf为词的idf*BM25_IDF_SCALE，查询时乘到每个倒排元素的权重上
+//position_offset/position_size为位置信息在位置数据区中的位置，position_size为0表示没有位置信息
+struct posting_meta{
+    uint64_t data_offset;
+    uint32_t data_size;
+    uint32_t block_begin;
+    uint32_t block_count;
+    uint32_t count;
+    uint32_t max_weight;
+    uint32_t position_size;
+    uint32_t idf;
+    uint32_t reserved;
+    uint64_t position_offset;
+};
+
+//权重量化表，下标为量化后的1字节编码
+class weight_table{
+public:
+    static const weight_table& get(){
+        static weight_table table;
+        return table;
+    }
+    int dequantize(uint8_t code) const {
+        return values_[code];
+    }
+    uint8_t quantize(int weight) const {
+        if(weight<=0) return 0;
+        if(weight<128) return weight;
+        //在等比区间中找最后一个不超过weight的编码
+        int code = 127;
+        while(code<255&&values_[code+1]<=weight){
+            code++;
+        }
+        return code;
+    }
+private:
+    weight_table(){
+        for(int i = 0;i<128;i++){
+            values_[i] = i;
+        }
+        for(int i = 128;i<256;i++){
+            values_[i] = (int)std::lround(128*std::pow(1.05,i-128));
+            if(values_[i]<=values_[i-1]) values_[i] = values_[i-1]+1;
+        }
+    }
+    int values_[256];
+};
+
+//out可以是std::vector<uint8_t>或者std::string
+template<class Out>
+inline void write_varint(Out& out,uint32_t value){
+    while(value>=0x80){
+        out.push_back((uint8_t)(value|0x80));
+        value>>=7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+//解码一个varint，越过end视为数据损坏，返回nullptr
+inline const uint8_t* read_varint(const uint8_t* p,const uint8_t* end,uint32_t* value){
+    uint32_t res = 0;
+    for(int shift = 0;shift<35&&p<end;shift+=7){
+        uint8_t byte = *p++;
+        res|=(uint32_t)(byte&0x7f)<<shift;
+        if((byte&0x80) == 0){
+            *value = res;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+//把一个词按id升序排好的倒排元素(id,weight)压缩后追加到块表和数据区，返回该词的位置信息
+template<class Iter>
+posting_meta encode_postings(Iter begin,Iter end,std::vector<posting_block>& blocks,std::vector<uint8_t>& data){
+    const weight_table& table = weight_table::get();
+    posting_meta meta;
+    meta.data_offset = data.size();
+    meta.block_begin = blocks.size();
+    meta.block_count = 0;
+    meta.count = 0;
+    meta.max_weight = 0;
+    meta.position_size = 0;
+    meta.idf = 1;
+    meta.reserved = 0;
+    meta.position_offset = 0;
+    uint32_t prev = 0;
+    uint8_t codes[POSTING_BLOCK_SIZE];
+    while(begin!=end){
+        posting_block block;
+        block.offset = data.size()-meta.data_offset;
+        block.count = 0;
+        block.max_code = 0;
+        block.reserved = 0;
+        for(;begin!=end&&block.count<POSTING_BLOCK_SIZE;++begin){
+            uint32_t id = begin->id_;
+            write_varint(data,id-prev);
+            uint8_t code = table.quantize(begin->weight_);
+            codes[block.count++] = code;
+            block.max_code = std::max(block.max_code,code);
+            prev = id;
+        }
+        meta.max_weight = std::max<uint32_t>(meta.max_weight,table.dequantize(block.max_code));
+        data.insert(data.end(),codes,codes+block.count);
+        block.last_id = prev;
+        blocks.push_back(block);
+        meta.block_count++;
+        meta.count+=block.count;
+    }
+    meta.data_size = data.size()-meta.data_offset;
+    return meta;
+}
+
+//一个文档中某个词的全部位置，都是升序的
+struct doc_positions{
+    std::vector<uint32_t> title;//title中的序号
+    std::vector<uint32_t> content;//content中的序号
+    std::vector<uint32_t> offsets;//content中的字节偏移，和content一一对应
+};
+
+//把一个文档中某个词的位置编码成字节串，追加到out
+inline void encode_doc_positions(const std::vector<uint32_t>& title,const std::vector<uint32_t>& content,
+                                 const std::vector<uint32_t>& offsets,std::string* out){
+    write_varint(*out,title.size());
+    write_varint(*out,content.size());
+    uint32_t prev = 0;
+    for(uint32_t pos:title){
+        write_varint(*out,pos-prev);
+        prev = pos;
+    }
+    uint32_t prev_pos = 0,prev_offset = 0;
+    for(size_t i = 0;i<content.size();i++){
+        //差值按uint32_t回绕计算，即使偏移不是单调的也能正确还原
+        write_varint(*out,content[i]-prev_pos);
+        write_varint(*out,offsets[i]-prev_offset);
+        prev_pos = content[i];
+        prev_offset = offsets[i];
+    }
+}
+
+//解码encode_doc_positions写出的字节串，数据损坏时返回false
+inline bool decode_doc_positions(const uint8_t* p,const uint8_t* end,doc_positions* out){
+    out->title.clear();
+    out->content.clear();
+    out->offsets.clear();
+    uint32_t title_count,content_count;
+    if((p = read_varint(p,end,&title_count)) == nullptr||(p = read_varint(p,end,&content_count)) == nullptr
+        ||title_count>(uint32_t)(end-p)||content_count>(uint32_t)(end-p)){
+        return false;
+    }
+    //个数已经按剩余字节数检查过，先一次性分配好再逐个填
+    out->title.resize(title_count);
+    out->content.resize(content_count);
+    out->offsets.resize(content_count);
+    uint32_t value = 0,pos = 0;
+    for(uint32_t i = 0;i<title_count;i++){
+        if((p = read_varint(p,end,&value)) == nullptr) return false;
+        pos+=value;
+        out->title[i] = pos;
+    }
+    uint32_t offset = 0;
+    pos = 0;
+    for(uint32_t i = 0;i<content_count;i++){
+        if((p = read_varint(p,end,&value)) == nullptr) return false;
+        pos+=value;
+        if((p = read_varint(p,end,&value)) == nullptr) return false;
+        offset+=value;
+        out->content[i] = pos;
+        out->offsets[i] = offset;
+    }
+    return true;
+}
+
+//把按id升序排好的倒排元素的位置信息（positions_）追加到位置块表和位置数据区，结果记到meta里
+//块的划分和encode_postings一致，每个倒排块都对应一个位置块表项；所有元素都没有位置信息时不占数据区
+template<class Iter>
+void encode_positions(Iter begin,Iter end,std::vector<uint32_t>& blocks,std::vector<uint8_t>& data,posting_meta* meta){
+    meta->position_offset = data.size();
+    meta->position_size = 0;
+    bool any = std::any_of(begin,end,[](const typename std::iterator_traits<Iter>::value_type& item){
+        return !item.positions_.empty();
+    });
+    uint32_t count = 0;
+    for(;begin!=end;++begin,++count){
+        if(count%POSTING_BLOCK_SIZE == 0){
+            blocks.push_back(data.size()-meta->position_offset);
+        }
+        if(any){
+            write_varint(data,begin->positions_.size());
+            data.insert(data.end(),begin->positions_.begin(),begin->positions_.end());
+        }
+    }
+    meta->position_size = data.size()-meta->position_offset;
+}
+
+//一个词的压缩倒排拉链的只读视图，max_weight_是乘过idf之后的最大权重
+class posting_list_view{
+public:
+    posting_list_view(){}
+    posting_list_view(const posting_block* blocks,uint32_t block_count,const uint8_t* data,uint32_t data_size,uint32_t count,
+                      int max_weight,int idf = 1)
+    :blocks_(blocks)
+    ,block_count_(block_count)
+    ,data_(data)
+    ,data_size_(data_size)
+    ,count_(count)
+    ,max_weight_(max_weight*idf)
+    ,idf_(idf)
+    {}
+    uint32_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    bool has_positions() const { return position_size_>0; }
+public:
+    const posting_block* blocks_ = nullptr;
+    uint32_t block_count_ = 0;
+    const uint8_t* data_ = nullptr;
+    uint32_t data_size_ = 0;
+    uint32_t count_ = 0;
+    int max_weight_ = 0;
+    int idf_ = 1;
+    //位置信息，position_blocks_和blocks_一一对应，没有位置信息时为空
+    const uint32_t* position_blocks_ = nullptr;
+    const uint8_t* positions_ = nullptr;
+    uint32_t position_size_ = 0;
+};
+
+//根据词的位置信息构造视图，blocks/data/position_blocks/positions为块表和数据区的起点
+inline posting_list_view make_posting_view(const posting_meta& meta,const posting_block* blocks,const uint8_t* data,
+                                           const uint32_t* position_blocks,const uint8_t* positions){
+    posting_list_view list(blocks+meta.block_begin,meta.block_count,data+meta.data_offset,meta.data_size,meta.count,meta.max_weight,meta.idf);
+    if(meta.position_size>0&&position_blocks!=nullptr&&positions!=nullptr){
+        list.position_blocks_ = position_blocks+meta.block_begin;
+        list.positions_ = positions+meta.position_offset;
+        list.position_size_ = meta.position_size;
+    }
+    return list;
+}
+
+//按块解码的倒排拉链迭代器
+//用法：for(posting_iterator iter(list);iter.valid();iter.next()){ iter.id(); iter.weight(); }
+class posting_iterator{
+public:
+    explicit posting_iterator(const posting_list_view& list)
+    :list_(list)
+    {
+        decode_block(0);
+    }
+    //直接定位到第一个id>=target的元素，只解码target所在的块，用于按文档查找单个元素
+    posting_iterator(const posting_list_view& list,uint64_t target)
+    :list_(list)
+    {
+        const posting_block* iter = std::lower_bound(list_.blocks_,list_.blocks_+list_.block_count_,target,[](const posting_block& block,uint64_t id){
+            return block.last_id<id;
+        });
+        decode_block(iter-list_.blocks_);
+        next_geq(target);
+    }
+    bool valid() const {
+        return pos_<size_;
+    }
+    uint64_t id() const {
+        return ids_[pos_];
+    }
+    //当前元素的得分：保存的词频部分乘上词的idf
+    int weight() const {
+        return weight_table::get().dequantize(weights_[pos_])*list_.idf_;
+    }
+    //保存的词频部分，没有乘idf，合并增量段时原样拷贝
+    int tf_weight() const {
+        return weight_table::get().dequantize(weights_[pos_]);
+    }
+    void next(){
+        if(++pos_>=size_){
+            decode_block(block_+1);
+        }
+    }
+    //跳到第一个id>=target的元素，先在块表上跳过整块，再在块内顺序查找
+    //块表上用指数查找（galloping）：从下一块开始按1,2,4...的步长往后试，找到范围后再二分，
+    //花费只和跳过的块数的对数有关，求交集时大多数跳转都很短，比在剩下的整张块表上二分更快
+    void next_geq(uint64_t target){
+        while(valid()){
+            if(target>list_.blocks_[block_].last_id){
+                uint32_t low = block_+1,bound = 1;
+                while(low+bound<=list_.block_count_&&list_.blocks_[low+bound-1].last_id<target){
+                    low+=bound;
+                    bound*=2;
+                }
+                const posting_block* begin = list_.blocks_+low;
+                const posting_block* end = list_.blocks_+std::min(low+bound,list_.block_count_);
+                const posting_block* iter = std::lower_bound(begin,end,target,[](const posting_block& block,uint64_t id){
+                    return block.last_id<id;
+                });
+                decode_block(iter-list_.blocks_);
+                continue;
+            }
+            while(pos_<size_&&ids_[pos_]<target){
+                pos_++;
+            }
+            if(pos_<size_){
+                return;
+            }
+            decode_block(block_+1);
+        }
+    }
+    //不解码，只在块表上找到可能包含target的块，带回该块的最大权重和最后一个id
+    //target必须单调不减，返回false表示target之后已经没有元素了
+    bool shallow_seek(uint64_t target,int* max_weight,uint64_t* last_id){
+        if(shallow_<block_){
+            shallow_ = block_;
+        }
+        while(shallow_<list_.block_count_&&list_.blocks_[shallow_].last_id<target){
+            shallow_++;
+        }
+        if(shallow_>=list_.block_count_){
+            return false;
+        }
+        *max_weight = weight_table::get().dequantize(list_.blocks_[shallow_].max_code)*list_.idf_;
+        *last_id = list_.blocks_[shallow_].last_id;
+        return true;
+    }
+    //整条倒排拉链的最大权重
+    int max_weight() const {
+        return list_.max_weight_;
+    }
+    //当前元素编码后的位置信息，倒排拉链没有位置信息或者数据损坏时返回false
+    //块内的位置信息只能顺序跳过，记住上次走到的元素，在同一块里向后查找时接着走
+    bool positions(const uint8_t** begin,const uint8_t** end){
+        if(!list_.has_positions()||!valid()||list_.position_blocks_[block_]>list_.position_size_){
+            return false;
+        }
+        const uint8_t* limit = list_.positions_+list_.position_size_;
+        if(position_ptr_ == nullptr||position_pos_>pos_){
+            position_ptr_ = list_.positions_+list_.position_blocks_[block_];
+            position_pos_ = 0;
+        }
+        const uint8_t* p = position_ptr_;
+        for(uint32_t i = position_pos_;;i++){
+            const uint8_t* entry = p;
+            uint32_t len;
+            p = read_varint(p,limit,&len);
+            if(p == nullptr||len>(uint32_t)(limit-p)){
+                position_ptr_ = nullptr;
+                return false;
+            }
+            if(i == pos_){
+                position_ptr_ = entry;
+                position_pos_ = i;
+                *begin = p;
+                *end = p+len;
+                return true;
+            }
+            p+=len;
+        }
+    }
+private:
+    void decode_block(uint32_t block){
+        block_ = block;
+        pos_ = 0;
+        size_ = 0;
+        position_ptr_ = nullptr;
+        if(block>=list_.block_count_){
+            return;
+        }
+        const posting_block& entry = list_.blocks_[block];
+        const uint8_t* end = block+1<list_.block_count_?list_.data_+list_.blocks_[block+1].offset:list_.data_+list_.data_size_;
+        const uint8_t* p = list_.data_+entry.offset;
+        uint32_t prev = block == 0?0:list_.blocks_[block-1].last_id;
+        uint32_t count = entry.count<=POSTING_BLOCK_SIZE?entry.count:POSTING_BLOCK_SIZE;
+        for(uint32_t i = 0;i<count;i++){
+            uint32_t delta;
+            p = read_varint(p,end,&delta);
+            if(p == nullptr){
+                return;//数据损坏，后面的元素都不要了
+            }
+            prev+=delta;
+            ids_[i] = prev;
+        }
+        if(p+count>end){
+            return;
+        }
+        memcpy(weights_,p,count);
+        size_ = count;
+    }
+private:
+    posting_list_view list_;
+    uint32_t block_ = 0;
+    uint32_t shallow_ = 0;
+    uint32_t pos_ = 0;
+    uint32_t size_ = 0;
+    uint32_t position_pos_ = 0;//position_ptr_指向块内第position_pos_个元素的位置信息
+    const uint8_t* position_ptr_ = nullptr;
+    uint32_t ids_[POSTING_BLOCK_SIZE];
+    uint8_t weights_[POSTING_BLOCK_SIZE];
+};
@@ -11,177 +11,1343 @@ yui的搜索引擎搜索篇
 
  Json::Value root;
 */
-#include <jsoncpp/json/json.h>
 #include <unordered_map>
 #include <algorithm>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <cctype>
+#include <strings.h>
 #include "Log.hpp"
 #include "index.hpp"
+#include "cache.hpp"
+#include "highlight.hpp"
+#include "json_writer.hpp"
+#include "metrics.hpp"
 
 
+//search各阶段的耗时，命中结果缓存的查询只记total
+struct search_metrics{
+    latency_histogram segment;//分词、解析查询语法
+    latency_histogram postings;//查倒排拉链并打分（布尔检索、WAND或者全量统计）
+    latency_histogram rerank;//按词的距离重新排序
+    latency_histogram snippet;//读取这一页的正排索引并生成摘要
+    latency_histogram json;//写出json、放进结果缓存
+    latency_histogram total;
+};
+
 /**
- * 存储query分词后字词在id中的权重和，以及记录字词
+ * 存储query分词后字词在id中的权重和，以及命中了哪些字词
+ * 命中的字词用位图记录，第i位表示query分词后的第i个词，超过64个词的部分都记在第63位上，
+ * 只在生成摘要时才根据位图取出字词，避免在打分的过程中拷贝字符串
  */
 class InvertedElemPrint{
 public:
-    InvertedElemPrint(uint64_t id = 0,int weight = 0)
+    InvertedElemPrint(uint64_t id = 0,int weight = 0,uint64_t mask = 0)
     :id_(id)
     ,weight_(weight)
+    ,mask_(mask)
     {}
 public:
     uint64_t id_;
     int weight_;
-    std::vector<std::string> words_;
+    uint64_t mask_;
+};
+
+//第i个查询词在位图中对应的位
+inline uint64_t word_bit(size_t i){
+    return 1ull<<(i<63?i:63);
+}
+
+/**
+ * 全量统计用的累加器：按文档id下标的稠密数组，term-at-a-time地把每个词的权重累加进去
+ * touched记录本次查询写过的文档，查询结束后只清理这些位置，
+ * 每个线程一份，在查询之间复用，打分的循环里不会再申请内存
+ */
+struct score_accumulator{
+    std::vector<int> weights;
+    std::vector<uint64_t> masks;//0表示该文档还没有被命中过
+    std::vector<uint32_t> touched;
+
+    void prepare(size_t doc_count){
+        if(weights.size()<doc_count){
+            weights.resize(doc_count,0);
+            masks.resize(doc_count,0);
+            touched.reserve(doc_count);
+        }
+    }
+    void clear(){
+        for(uint32_t id:touched){
+            weights[id] = 0;
+            masks[id] = 0;
+        }
+        touched.clear();
+    }
+};
+
+/**
+ * 查询中的一个条件：一个词、双引号括起来的短语，前面可以加title:只在标题中匹配
+ * begin/end为条件在查询语句中的字节范围，words为分词后的词在查询词（排除条件为排除词）中的下标，
+ * gaps为每个词的序号相对第一个词的差，短语要求文档中的词在同一个字段里按这个间隔出现
+ * 一个词被切成多个词时（比如“智能指针”），要求文档包含所有这些词
+ */
+struct query_atom{
+    uint32_t begin;
+    uint32_t end;
+    bool phrase;
+    bool title;
+    std::vector<uint32_t> words;
+    std::vector<uint32_t> gaps;
+};
+
+/**
+ * 用OR连起来的一组条件，文档满足其中任意一个就算满足这一组
+ * OPTIONAL：普通的词，只参与打分；REQUIRED：文档必须满足（+、AND、短语和title:）；EXCLUDED：文档不能满足（-、NOT）
+ */
+struct query_clause{
+    enum occur_t{OPTIONAL,REQUIRED,EXCLUDED};
+    occur_t occur;
+    std::vector<query_atom> atoms;
+};
+
+//查询中前后相邻的两个词（下标first、second），以及它们在查询中的序号差，用于邻近度加分
+struct proximity_pair{
+    uint32_t first;
+    uint32_t second;
+    uint32_t gap;
+};
+
+/**
+ * 一个词在基础索引和各个增量段上的游标，每个段一个迭代器，只向后跳
+ * 各段的文档id不相交，id()是各段当前id中最小的；按文档id升序seek，连续查找同一块中的文档时不重复解码
+ */
+class term_cursor{
+public:
+    term_cursor(){}
+    explicit term_cursor(const std::vector<posting_list_view>& lists){
+        reset(lists);
+    }
+    //改成遍历另一组倒排拉链（或者从头重新遍历），迭代器数组的内存留着复用
+    void reset(const std::vector<posting_list_view>& lists){
+        iters_.clear();
+        current_ = nullptr;
+        cost_ = 0;
+        for(const posting_list_view& list:lists){
+            iters_.emplace_back(list);
+            cost_+=list.size();
+        }
+    }
+    //各段当前文档id中最小的，都遍历完时返回UINT64_MAX
+    uint64_t id() const {
+        uint64_t id = UINT64_MAX;
+        for(const posting_iterator& iter:iters_){
+            if(iter.valid()){
+                id = std::min(id,iter.id());
+            }
+        }
+        return id;
+    }
+    //倒排元素的总数，求交集时从短的拉链开始
+    uint64_t cost() const {
+        return cost_;
+    }
+    void next_geq(uint64_t target){
+        for(posting_iterator& iter:iters_){
+            if(iter.valid()&&iter.id()<target){
+                iter.next_geq(target);
+            }
+        }
+    }
+    //文档id中是否有这个词，id必须单调不减；找到时记下所在的段，之后可以取权重和位置信息
+    bool seek(uint64_t id){
+        current_ = nullptr;
+        for(posting_iterator& iter:iters_){
+            if(iter.valid()&&iter.id()<id){
+                iter.next_geq(id);
+            }
+            if(iter.valid()&&iter.id() == id){
+                current_ = &iter;
+                return true;
+            }
+        }
+        return false;
+    }
+    //seek找到之后调用：这个词在文档中的权重
+    int weight() const {
+        return current_->weight();
+    }
+    //seek找到之后调用：解码位置信息，返回1；索引没有保存位置信息时返回0
+    int positions(doc_positions* out){
+        const uint8_t* begin = nullptr;
+        const uint8_t* end = nullptr;
+        if(!current_->positions(&begin,&end)||!decode_doc_positions(begin,end,out)){
+            return 0;
+        }
+        return 1;
+    }
+    //不解码，查看target所在块的最大权重（各段中最大的）和块的结束位置（各段中最小的last_id），target必须单调不减
+    //返回false表示target之后已经没有元素了
+    bool block_max(uint64_t target,int* max_weight,uint64_t* last_id){
+        bool found = false;
+        *max_weight = 0;
+        *last_id = UINT64_MAX;
+        for(posting_iterator& iter:iters_){
+            int weight;
+            uint64_t last;
+            if(iter.valid()&&iter.shallow_seek(target,&weight,&last)){
+                found = true;
+                *max_weight = std::max(*max_weight,weight);
+                *last_id = std::min(*last_id,last);
+            }
+        }
+        return found;
+    }
+    //id必须单调递增，返回值：-1表示文档中没有这个词，0表示有这个词但是没有位置信息（索引没有保存位置），1表示找到了位置信息
+    int seek(uint64_t id,doc_positions* out){
+        return seek(id)?positions(out):-1;
+    }
+private:
+    std::vector<posting_iterator> iters_;
+    posting_iterator* current_ = nullptr;
+    uint64_t cost_ = 0;
+};
+
+//当前页的一条结果，index为在排好序的结果中的下标；摘要已经转义成json字符串（带引号），存放在query_scratch::snippet_json中
+struct page_doc{
+    size_t index;
+    bool found;
+    DocView doc;
+    uint32_t snippet_begin;
+    uint32_t snippet_size;
+};
+
+/**
+ * 每个查询线程自己的临时数据：分词结果、条件、每个词的倒排拉链、排好序的结果、游标、当前页、生成摘要的缓冲区、缓存key
+ * thread_local保存，在查询之间复用，查询过程中不会和其他线程共享任何可写的数据
+ */
+struct query_scratch{
+    std::string text;//去掉运算符之后用来分词的查询语句
+    token_list tokens;//分词结果，词已经转成小写
+    std::vector<std::string> words;//参与打分的查询词
+    std::vector<std::string> excluded;//排除条件中的词，不打分也不高亮
+    std::vector<query_clause> clauses;
+    std::vector<std::pair<uint32_t,uint32_t>> atom_index;//按起始位置排列的所有条件：(第几组,组内第几个)
+    bool filtered = false;//是否有必须满足或者必须排除的条件
+    std::vector<proximity_pair> pairs;
+    std::vector<std::vector<posting_list_view>> lists;//下标和words一致
+    std::vector<std::vector<posting_list_view>> excluded_lists;//下标和excluded一致
+    std::vector<InvertedElemPrint> results;
+    std::vector<term_cursor> cursors;//邻近度加分和生成摘要用的游标，下标和words一致，用之前reset
+    std::vector<page_doc> page;
+    snippet_builder snippets;//生成摘要用的自动机和缓冲区
+    std::string snippet_json;//这一页所有摘要的json字符串，按文档id的顺序依次追加
+    std::string cache_key;
 };
 
 // const std::string input = "./data/raw_html/raw.txt";
 
+//分页参数：默认每页的结果数，以及一页最多允许的结果数
+const size_t DEFAULT_PAGE_SIZE = 10;
+const size_t MAX_PAGE_SIZE = 100;
+//需要的结果数(start+count)不超过这个值时使用WAND剪枝，翻页太深时剪枝效果很差，直接全量统计
+const size_t WAND_MAX_TOPK = 1000;
+//多词查询时对前PROXIMITY_DEPTH个结果按查询词在文档中的距离加分后重新排序
+const size_t PROXIMITY_DEPTH = 50;
+//查询中相邻的两个词在文档中按同样的间隔出现时加PROXIMITY_BONUS分，间隔每差1加分减半，差PROXIMITY_WINDOW及以上不加分
+//分数的单位见bm25.hpp，PROXIMITY_BONUS相当于一个idf为1的词在文档中出现一次（词频部分为1）
+const int PROXIMITY_BONUS = BM25_IDF_SCALE*BM25_TF_SCALE;
+const uint32_t PROXIMITY_WINDOW = 4;
+//摘要：从选中的查询词往前取SNIPPET_BEFORE字节，往后取SNIPPET_AFTER字节
+const size_t SNIPPET_BEFORE = 50;
+const size_t SNIPPET_AFTER = 100;
+
 /**
  * searcher具有的属性：Index、
+ * 并发：init_search、set_pruning、set_cache_capacity在启动服务之前调用，
+ * 之后search只读Index和Searcher的成员（结果缓存自带锁），临时数据都是thread_local的，
+ * 可以被HTTP服务的多个工作线程同时调用
+ * 热替换：reload_index在调用线程里构造一份新的索引，准备好之后原子地替换index指针，
+ * 每个查询开始时持有一份当前索引的shared_ptr，正在进行的查询继续使用旧索引，最后一个查询结束时旧索引才被释放
  */
 class Searcher{
 private:
-    Index* index;
+    std::shared_ptr<Index> index;//只通过std::atomic_load/atomic_store访问
+    bool enable_pruning = true;//是否允许使用WAND剪枝，关闭后总是全量统计，结果应当完全一致
+    bool enable_proximity = true;//多词查询是否按词的距离加分
+    std::unique_ptr<result_cache> cache;//查询结果缓存，默认不开启
+    mutable search_metrics stage_metrics;//各阶段的耗时，多个查询线程同时记录
+    //init_search的参数，reload_index按同样的方式重新加载
+    std::string input_file;
+    std::string snapshot_file;
+    bool mmap_snapshot = false;
+    std::string delta_file;
+    std::mutex reload_mtx;//reload_index、update_index互斥，查询不需要这把锁
 public:
     Searcher(){}
     ~Searcher(){}
-    void init_search(const std::string input){
+    void init_search(const std::string input,const std::string snapshot = "",bool use_mmap = false,const std::string delta = ""){
         //初始化，创建index，建立索引
-        index = Index::get_instance();
-        LOG(Level::INFO,"创建单例模式");
-        index->create_index(input);
-        LOG(Level::INFO,"创建索引");
+        //有快照时优先加载快照，没有或者加载失败时再从raw.txt建索引，并顺手写一份快照给下次启动用
+        //use_mmap为true时以只读mmap的方式使用快照，多个进程可以共享同一份page cache
+        //delta为增量解析产生的变更日志，加载快照后把日志中的变更应用到索引上；从raw.txt重建时变更已经包含在内，清空日志
+        std::lock_guard<std::mutex> lock(reload_mtx);
+        input_file = input;
+        snapshot_file = snapshot;
+        mmap_snapshot = use_mmap;
+        delta_file = delta;
+        std::shared_ptr<Index> fresh;
+        open_index(&fresh);
+        std::atomic_store(&index,fresh);
+    }
+
+    //重新加载快照（快照不可用时从raw.txt重建）并应用变更日志，准备好之后替换正在使用的索引
+    //耗时较长，可以和查询同时进行；加载失败时保留旧索引，返回false
+    bool reload_index(){
+        std::lock_guard<std::mutex> lock(reload_mtx);
+        std::shared_ptr<Index> fresh;
+        if(!open_index(&fresh)){
+            LOG(Level::WARNING,"重新加载索引失败，继续使用旧索引");
+            return false;
+        }
+        std::atomic_store(&index,fresh);
+        if(cache){
+            //缓存key里带有索引的版本号，旧结果不会再被命中，这里只是尽早释放内存
+            cache->clear();
+        }
+        LOG(Level::INFO,"索引已替换，文档数%llu",(unsigned long long)index_reader(fresh.get()).doc_count());
+        return true;
+    }
+
+    //应用变更日志中新追加的变更，返回应用的变更条数，可以和查询同时进行
+    int update_index(const std::string& delta){
+        std::lock_guard<std::mutex> lock(reload_mtx);
+        std::shared_ptr<Index> current = std::atomic_load(&index);
+        int count = current->apply_delta(delta);
+        if(count>0&&cache){
+            //缓存key里带有索引的版本号，旧结果不会再被命中，这里只是尽早释放内存
+            cache->clear();
+        }
+        return count;
     }
 
-    //开始进行搜索，需要的参数：搜索语句，返回值json_res(输入输出型)
-    void search(const std::string query,std::string& json_res){
+    //开始进行搜索，需要的参数：搜索语句，返回值json_res(输入输出型)，分页参数start(从第几个结果开始)、count(本页结果数)
+    void search(const std::string query,std::string& json_res,size_t start = 0,size_t count = DEFAULT_PAGE_SIZE) const {
         /**
          * 先对搜索语句进行分词，然后根据分词的内容获取倒排拉链
          * 有了倒排拉链后，根据倒排拉链开始计算搜索语句在不同id下的权重和，利用哈希表存储
-         * 后续把哈希表中的value 转储到数组中，对数组进行排序（desc）
-         * 然后根据数组内容，获取正排索引，在截取部分内容后建立json串
+         * 后续把哈希表中的value 转储到数组中，只对前start+count个结果做部分排序（desc）
+         * 然后只对请求的这一页结果获取正排索引，在截取部分内容后建立json串
+         * 需要的结果不多时改用WAND按文档id逐个计算（wand_search），可以跳过大部分不可能进入前K名的倒排元素
+         * 有必须满足或者必须排除的条件（+、-、短语、title:等，见parse_query）时改用boolean_search，
+         * 在必须满足的词的倒排拉链上求交集，只检查交集中的文档；多词查询再按词在文档中的距离给前面的结果加分
          */
-        std::vector<std::string> words;
-        JiebaUtil::CutString(query,&words);//开始进行分词
-        std::vector<InvertedElemPrint> inverted_all;
-        std::unordered_map<uint64_t,InvertedElemPrint> cnt;
-        for(std::string&word:words){
-            //获取倒排拉链
-            boost::to_lower(word);//转小写
-            inverted_list* invertedList = index->get_inverted_index(word);
-            if(nullptr == invertedList){
+        static thread_local query_scratch scratch;
+        stopwatch stage_timer;
+        uint64_t total_ns = 0;
+        //持有当前索引的引用，查询期间即使索引被替换，旧索引也不会被释放
+        std::shared_ptr<Index> current = std::atomic_load(&index);
+        index_reader reader(current.get());//整个查询使用同一份索引视图
+        parse_query(query,&scratch);//开始进行分词
+        total_ns+=record_stage(stage_metrics.segment,stage_timer);
+        std::vector<std::string>& words = scratch.words;
+        //先查结果缓存，分词并转小写后相同的查询共用同一份结果
+        std::string& cache_key = scratch.cache_key;
+        if(cache){
+            make_cache_key(scratch,start,count,reader.generation(),&cache_key);
+            if(cache->get(cache_key,&json_res)){
+                stage_metrics.total.record(total_ns+stage_timer.lap());
+                return;
+            }
+        }
+        //每个词的倒排拉链只查一次，打分、短语匹配、邻近度加分和生成摘要都用这一份
+        std::vector<std::vector<posting_list_view>>& lists = scratch.lists;
+        if(lists.size()<words.size()){
+            lists.resize(words.size());
+        }
+        for(size_t i = 0;i<words.size();i++){
+            reader.get_inverted_index(words[i],&lists[i]);
+        }
+        std::vector<std::vector<posting_list_view>>& excluded_lists = scratch.excluded_lists;
+        if(excluded_lists.size()<scratch.excluded.size()){
+            excluded_lists.resize(scratch.excluded.size());
+        }
+        for(size_t i = 0;i<scratch.excluded.size();i++){
+            reader.get_inverted_index(scratch.excluded[i],&excluded_lists[i]);
+        }
+        //按权重desc、id asc排好序的前topk个结果，需要按距离重新排序时至少取前PROXIMITY_DEPTH个
+        std::vector<InvertedElemPrint>& inverted_all = scratch.results;
+        inverted_all.clear();
+        size_t topk = start+count;
+        bool rerank = enable_proximity&&!scratch.pairs.empty();
+        size_t depth = rerank?std::max(topk,PROXIMITY_DEPTH):topk;
+        if(scratch.filtered){
+            boolean_search(reader,scratch,depth,&inverted_all);
+        }else if(enable_pruning&&depth<=WAND_MAX_TOPK){
+            wand_search(reader,lists,words.size(),depth,&inverted_all);
+        }else{
+            exhaustive_search(reader,lists,words.size(),depth,&inverted_all);
+        }
+        total_ns+=record_stage(stage_metrics.postings,stage_timer);
+        if(rerank){
+            proximity_rerank(scratch,&inverted_all);
+            total_ns+=record_stage(stage_metrics.rerank,stage_timer);
+        }
+        size_t end = std::min(inverted_all.size(),topk);
+
+        //排完序后，开始获取这一页的正排索引
+        //摘要按文档id升序生成，每个词的位置信息用一个term_cursor向后查找，直接转义成json字符串追加到snippet_json，再按排好的顺序输出
+        std::vector<page_doc>& page = scratch.page;
+        page.clear();
+        for(size_t i = start;i<end;i++){
+            page.push_back(page_doc{i,false,DocView(),0,0});
+        }
+        std::sort(page.begin(),page.end(),[&inverted_all](const page_doc& a,const page_doc& b){
+            return inverted_all[a.index].id_<inverted_all[b.index].id_;
+        });
+        std::vector<term_cursor>& cursors = scratch.cursors;
+        if(cursors.size()<words.size()){
+            cursors.resize(words.size());
+        }
+        for(size_t i = 0;i<words.size();i++){
+            cursors[i].reset(lists[i]);
+        }
+        std::string& snippet_json = scratch.snippet_json;
+        snippet_json.clear();
+        scratch.snippets.set_words(words);
+        for(page_doc& item:page){
+            item.found = reader.get_forward_index(inverted_all[item.index].id_,&item.doc);
+            if(item.found){
+                item.snippet_begin = snippet_json.size();
+                make_snippet(scratch,cursors,inverted_all[item.index],item.doc.content_,&snippet_json);
+                item.snippet_size = snippet_json.size()-item.snippet_begin;
+            }
+        }
+        std::sort(page.begin(),page.end(),[](const page_doc& a,const page_doc& b){
+            return a.index<b.index;
+        });
+        total_ns+=record_stage(stage_metrics.snippet,stage_timer);
+        //直接写出json（见json_writer.hpp），和原来Json::FastWriter的输出一致：字段按字典序，结尾换行，没有结果时为null
+        json_res.clear();
+        size_t written = 0;
+        for(page_doc& item:page){
+            if(!item.found){
+                continue;
+            }
+            json_res+=written++ == 0?"[{\"content\":":",{\"content\":";
+            json_res.append(snippet_json,item.snippet_begin,item.snippet_size);
+            json_res+=",\"title\":";
+            append_json_string(item.doc.title_,&json_res);
+            json_res+=",\"url\":";
+            append_json_string(item.doc.url_,&json_res);
+            json_res+='}';
+        }
+        json_res+=written == 0?"null\n":"]\n";
+        page.clear();//释放这一页持有的正文块和索引视图，vector的内存留着复用
+        if(cache){
+            cache->put(cache_key,json_res);
+        }
+        total_ns+=record_stage(stage_metrics.json,stage_timer);
+        stage_metrics.total.record(total_ns);
+    }
+
+    //开启查询结果缓存，capacity为缓存占用内存的上限（字节），为0时关闭缓存
+    //需要在开始处理查询之前设置
+    void set_cache_capacity(size_t capacity,size_t shard_num = 16){
+        if(capacity == 0){
+            cache.reset();
+            return;
+        }
+        cache.reset(new result_cache(capacity,shard_num));
+    }
+
+    //输入联想：以prefix开头的词中文档频率最高的至多count个，结果为json字符串数组，写入json_res
+    //只查预先建好的前缀树（见suggest.hpp），除了json_res本身的扩容不申请内存，可以在每次按键时调用
+    void suggest(std::string_view prefix,std::string& json_res,size_t count = SUGGEST_TOP_K) const {
+        static thread_local std::string key;
+        key.clear();
+        for(char ch:prefix){
+            key.push_back(ascii_lower(ch));//索引中的词都是小写的
+        }
+        std::shared_ptr<Index> current = std::atomic_load(&index);
+        uint32_t ids[SUGGEST_TOP_K];
+        size_t n = key.empty()?0:current->get_suggester().suggest(key,ids,count);
+        json_res.clear();
+        json_res.push_back('[');
+        for(size_t i = 0;i<n;i++){
+            if(i>0){
+                json_res.push_back(',');
+            }
+            append_json_string(current->get_dictionary().word_at(ids[i]),&json_res);
+        }
+        json_res.push_back(']');
+    }
+
+    //缓存的命中统计，没有开启缓存时全部为0
+    cache_stats get_cache_stats() const {
+        return cache?cache->get_stats():cache_stats();
+    }
+
+    //当前索引的正文解压块缓存的命中统计，热替换索引后重新计数
+    cache_stats get_content_cache_stats() const {
+        std::shared_ptr<Index> current = std::atomic_load(&index);
+        return current?current->get_content_cache_stats():cache_stats();
+    }
+
+    //Prometheus文本格式的监控指标：查询各阶段的耗时、索引规模、两级缓存的命中统计、建索引各阶段的耗时，追加到out
+    void write_metrics(std::string* out) const {
+        append_metric_header(out,"yui_search_stage_seconds","histogram","Time spent in each stage of a search request.");
+        const std::pair<const char*,const latency_histogram*> stages[] = {
+            {"segment",&stage_metrics.segment},{"postings",&stage_metrics.postings},{"rerank",&stage_metrics.rerank},
+            {"snippet",&stage_metrics.snippet},{"json",&stage_metrics.json}
+        };
+        for(auto& stage:stages){
+            append_histogram(out,"yui_search_stage_seconds",std::string("stage=\"")+stage.first+"\"",*stage.second);
+        }
+        append_metric_header(out,"yui_search_request_seconds","histogram","Total time of a search request, including result cache hits.");
+        append_histogram(out,"yui_search_request_seconds","",stage_metrics.total);
+
+        std::shared_ptr<Index> current = std::atomic_load(&index);
+        if(current){
+            index_size_stats size = current->get_size_stats();
+            const struct{ const char* name; const char* help; uint64_t value; } gauges[] = {
+                {"yui_index_docs","Documents in the base index.",size.docs},
+                {"yui_index_terms","Terms in the base index dictionary.",size.terms},
+                {"yui_index_postings","Postings in the base index.",size.postings},
+                {"yui_index_segments","Delta segments applied on top of the base index.",size.segments},
+                {"yui_index_segment_docs","Documents in the delta segments.",size.segment_docs},
+                {"yui_index_deleted_docs","Documents deleted or replaced by the delta log.",size.deleted_docs}
+            };
+            for(auto& gauge:gauges){
+                append_metric_header(out,gauge.name,"gauge",gauge.help);
+                append_metric_value(out,gauge.name,"","",gauge.value);
+            }
+            append_metric_header(out,"yui_index_bytes","gauge","Bytes used by each part of the index.");
+            const std::pair<const char*,uint64_t> parts[] = {
+                {"postings",size.posting_bytes},{"positions",size.position_bytes},{"content",size.content_bytes},
+                {"content_raw",size.content_raw_bytes},{"snapshot",size.snapshot_bytes}
+            };
+            for(auto& part:parts){
+                append_metric_value(out,"yui_index_bytes","",std::string("part=\"")+part.first+"\"",part.second);
+            }
+
+            const index_build_stats& build = current->get_build_stats();
+            append_metric_header(out,"yui_index_build_stage_seconds","gauge","Time spent in each stage of the last index build, 0 when loaded from a snapshot.");
+            const std::pair<const char*,uint64_t> build_stages[] = {
+                {"read",build.read_ns},{"tokenize",build.tokenize_ns},{"content",build.content_ns},
+                {"merge",build.merge_ns},{"dictionary",build.dictionary_ns},{"total",build.total_ns}
+            };
+            for(auto& stage:build_stages){
+                append_metric_value(out,"yui_index_build_stage_seconds","",std::string("stage=\"")+stage.first+"\"",stage.second/1e9);
+            }
+            append_metric_header(out,"yui_index_build_doc_seconds","histogram","Time to tokenize and count the words of one document in the last index build.");
+            append_histogram(out,"yui_index_build_doc_seconds","",build.tokenize_doc);
+        }
+
+        const std::pair<const char*,cache_stats> caches[] = {
+            {"results",get_cache_stats()},{"content_blocks",get_content_cache_stats()}
+        };
+        const char* counters[][2] = {
+            {"yui_cache_hits_total","Cache lookups that found an entry."},
+            {"yui_cache_misses_total","Cache lookups that found nothing."},
+            {"yui_cache_inserts_total","Entries put into the cache."},
+            {"yui_cache_evictions_total","Entries evicted to stay under the capacity."},
+            {"yui_cache_entries","Entries currently in the cache."},
+            {"yui_cache_bytes","Bytes currently used by the cache."},
+            {"yui_cache_capacity_bytes","Capacity of the cache in bytes, 0 when disabled."}
+        };
+        for(size_t i = 0;i<sizeof(counters)/sizeof(counters[0]);i++){
+            append_metric_header(out,counters[i][0],i<4?"counter":"gauge",counters[i][1]);
+            for(auto& c:caches){
+                const cache_stats& stats = c.second;
+                const uint64_t values[] = {stats.hits,stats.misses,stats.inserts,stats.evictions,stats.entries,stats.bytes,stats.capacity};
+                append_metric_value(out,counters[i][0],"",std::string("cache=\"")+c.first+"\"",values[i]);
+            }
+        }
+    }
+
+    //缓存的key：分词后的查询词用\x1f隔开，再记下邻近度加分的词对、每组必须满足/排除的条件（条件的类型、词的下标和间隔）、
+    //排除的词，最后加上分页参数和索引版本号
+    static void make_cache_key(const query_scratch& q,size_t start,size_t count,uint64_t generation,std::string* key){
+        key->clear();
+        for(const std::string& word:q.words){
+            *key+=word;
+            *key+='\x1f';
+        }
+        for(const proximity_pair& pair:q.pairs){
+            *key+=std::to_string(pair.first);
+            *key+='-';
+            *key+=std::to_string(pair.gap);
+            *key+=',';
+        }
+        for(const query_clause& clause:q.clauses){
+            if(clause.occur == query_clause::OPTIONAL){
                 continue;
             }
-            for(Inverted_item&item:(*invertedList)){
-                InvertedElemPrint& tmp_elem = cnt[item.id_];
-                tmp_elem.id_ = item.id_;
-                tmp_elem.weight_+=item.weight_;
-                tmp_elem.words_.push_back(item.word_);
+            *key+='\x1d';
+            *key+=clause.occur == query_clause::REQUIRED?'+':'-';
+            for(const query_atom& atom:clause.atoms){
+                *key+=atom.phrase?'"':'|';
+                *key+=atom.title?'t':'a';
+                for(size_t i = 0;i<atom.words.size();i++){
+                    *key+=std::to_string(atom.words[i]);
+                    *key+=':';
+                    *key+=std::to_string(atom.gaps[i]);
+                    *key+=',';
+                }
             }
         }
-        for(auto&item:cnt){
-            inverted_all.push_back(item.second);
+        for(const std::string& word:q.excluded){
+            *key+='\x1c';
+            *key+=word;
         }
-        //进行排序 desc
-        std::sort(inverted_all.begin(),inverted_all.end(),[=](InvertedElemPrint&a,InvertedElemPrint&b){
-            return a.weight_>b.weight_;
+        *key+='\x1e';
+        *key+=std::to_string(start);
+        *key+=',';
+        *key+=std::to_string(count);
+        *key+='@';
+        *key+=std::to_string(generation);
+    }
+
+    //打开/关闭WAND剪枝
+    void set_pruning(bool enable){
+        enable_pruning = enable;
+    }
+
+    //打开/关闭邻近度加分
+    void set_proximity(bool enable){
+        enable_proximity = enable;
+    }
+
+    /**
+     * 解析查询语句，支持的语法：
+     *   词            普通的词，只参与打分，文档包含任意一个查询词就可能出现在结果中
+     *   +词 / -词      文档必须包含 / 不能包含这个词
+     *   "短语"         文档中必须在同一个字段里按查询中的顺序和间隔出现这些词
+     *   title:词       只在标题中匹配，也可以写title:"短语"
+     *   a OR b         满足其中任意一个即可，整组的+、-由第一个条件决定
+     *   a AND b        两边都必须满足；NOT a 等同于 -a
+     * +、-、title:只在一个词的开头才算运算符（c++、shared-ptr不受影响），OR、AND、NOT必须大写；
+     * 短语和title:本身就是筛选条件，不加+也必须满足；引号没有成对时，最后一个引号按空格处理
+     * 做法：先扫描一遍查询语句，找出每个条件的字节范围，把运算符替换成空格（字节偏移不变），
+     * 再对整句分词一次，按每个词的字节偏移把它分到所在的条件里
+     */
+    static void parse_query(const std::string& query,query_scratch* q){
+        q->words.clear();
+        q->excluded.clear();
+        q->clauses.clear();
+        q->atom_index.clear();
+        q->pairs.clear();
+        q->filtered = false;
+        std::string& text = q->text;
+        text = query;
+        //1.找出每个条件，join表示和前一组用OR连接，require_next/exclude_next来自前面的AND、NOT
+        size_t i = 0,n = text.size();
+        bool join = false,require_next = false,exclude_next = false;
+        while(i<n){
+            if(isspace((unsigned char)text[i])){
+                i++;
+                continue;
+            }
+            query_atom atom{0,0,false,false,{},{}};
+            char sign = 0;
+            if((text[i] == '+'||text[i] == '-')&&i+1<n&&!isspace((unsigned char)text[i+1])){
+                sign = text[i];
+                text[i++] = ' ';
+            }
+            if(n-i>6&&strncasecmp(text.c_str()+i,"title:",6) == 0&&!isspace((unsigned char)text[i+6])){
+                atom.title = true;
+                std::fill(text.begin()+i,text.begin()+i+6,' ');
+                i+=6;
+            }
+            size_t close = text[i] == '"'?text.find('"',i+1):std::string::npos;
+            if(close!=std::string::npos){
+                atom.phrase = true;
+                text[i] = ' ';
+                text[close] = ' ';
+                atom.begin = i+1;
+                atom.end = close;
+                i = close+1;
+            }else{
+                if(text[i] == '"'){
+                    text[i++] = ' ';
+                }
+                size_t end = i;
+                while(end<n&&!isspace((unsigned char)text[end])&&text[end]!='"'){
+                    end++;
+                }
+                atom.begin = i;
+                atom.end = end;
+                i = end;
+            }
+            std::string_view word(text.data()+atom.begin,atom.end-atom.begin);
+            if(sign == 0&&!atom.title&&!atom.phrase&&(word == "OR"||word == "AND"||word == "NOT")){
+                if(word == "OR"){
+                    join = !q->clauses.empty();
+                }else if(word == "AND"){
+                    if(!q->clauses.empty()&&q->clauses.back().occur == query_clause::OPTIONAL){
+                        q->clauses.back().occur = query_clause::REQUIRED;
+                    }
+                    require_next = true;
+                }else{
+                    exclude_next = true;
+                }
+                std::fill(text.begin()+atom.begin,text.begin()+atom.end,' ');
+                continue;
+            }
+            if(!join){
+                query_clause::occur_t occur = query_clause::OPTIONAL;
+                if(sign == '-'||exclude_next){
+                    occur = query_clause::EXCLUDED;
+                }else if(sign == '+'||require_next){
+                    occur = query_clause::REQUIRED;
+                }
+                q->clauses.push_back(query_clause{occur,{}});
+            }
+            q->clauses.back().atoms.push_back(std::move(atom));
+            q->atom_index.emplace_back(q->clauses.size()-1,q->clauses.back().atoms.size()-1);
+            join = require_next = exclude_next = false;
+        }
+        //2.整句分词，每个词分到字节范围包含它的条件里，条件按起始位置排好序，二分查找
+        JiebaUtil::CutTokens(text,&q->tokens);
+        auto atom_at = [q](size_t k)->query_atom& {
+            return q->clauses[q->atom_index[k].first].atoms[q->atom_index[k].second];
+        };
+        auto plain = [](const query_atom& atom){
+            return !atom.phrase&&!atom.title;
+        };
+        size_t prev_atom = SIZE_MAX;//前一个参与打分的词所在的条件
+        uint32_t prev_position = 0;
+        for(const token_pos& token:q->tokens.tokens){
+            size_t low = 0,high = q->atom_index.size();
+            while(low<high){
+                size_t mid = (low+high)/2;
+                if(atom_at(mid).end<=token.offset){
+                    low = mid+1;
+                }else{
+                    high = mid;
+                }
+            }
+            if(low == q->atom_index.size()||atom_at(low).begin>token.offset){
+                continue;
+            }
+            query_atom& atom = atom_at(low);
+            bool scored = q->clauses[q->atom_index[low].first].occur!=query_clause::EXCLUDED;
+            std::string_view word = q->tokens.word(token);
+            if(scored){
+                //同一个条件中，或者相邻的两个普通词（不在同一个OR组里）中，序号递增的前后两个词算一对
+                //从长词中切出来的短词和长词序号相同，不算
+                bool adjacent = low == prev_atom||(prev_atom!=SIZE_MAX&&low == prev_atom+1&&plain(atom)&&plain(atom_at(prev_atom))
+                                                   &&q->atom_index[low].first!=q->atom_index[prev_atom].first);
+                if(adjacent&&token.position>prev_position&&word!=q->words.back()){
+                    q->pairs.push_back(proximity_pair{(uint32_t)q->words.size()-1,(uint32_t)q->words.size(),token.position-prev_position});
+                }
+                prev_atom = low;
+                prev_position = token.position;
+            }
+            std::vector<std::string>& target = scored?q->words:q->excluded;
+            atom.words.push_back(target.size());
+            atom.gaps.push_back(token.position);//先记下序号，最后再减去第一个词的序号
+            target.emplace_back(word);
+        }
+        //3.确定每组条件的类型：短语和title:默认必须满足；
+        //必须满足的组里有不含任何词的条件（比如全是停用词）时这一组总是满足，当作普通的词；排除组去掉不含词的条件
+        for(query_clause& clause:q->clauses){
+            bool has_empty = false,has_filter = false;
+            for(query_atom& atom:clause.atoms){
+                for(size_t k = atom.gaps.size();k-->0;){
+                    atom.gaps[k]-=atom.gaps[0];
+                }
+                has_empty = has_empty||atom.words.empty();
+                has_filter = has_filter||!plain(atom);
+            }
+            if(clause.occur == query_clause::EXCLUDED){
+                clause.atoms.erase(std::remove_if(clause.atoms.begin(),clause.atoms.end(),[](const query_atom& atom){
+                    return atom.words.empty();
+                }),clause.atoms.end());
+                q->filtered = q->filtered||!clause.atoms.empty();
+                continue;
+            }
+            if(clause.occur == query_clause::OPTIONAL&&has_filter){
+                clause.occur = query_clause::REQUIRED;
+            }
+            if(has_empty){
+                clause.occur = query_clause::OPTIONAL;
+            }
+            q->filtered = q->filtered||clause.occur == query_clause::REQUIRED;
+        }
+    }
+
+    //结果排序规则：权重desc，权重相同时按id asc，保证翻页时结果稳定
+    static bool better_result(uint64_t id_a,int weight_a,uint64_t id_b,int weight_b){
+        return weight_a!=weight_b?weight_a>weight_b:id_a<id_b;
+    }
+
+    //全量统计：term-at-a-time地遍历每个词的整条倒排拉链，把权重累加到稠密数组中，再部分排序出前topk个
+    //lists[i]为第i个查询词在基础索引和每个增量段中的倒排拉链
+    //增量段的文档可能已经被删除，has_deleted时跳过打了删除标记的文档
+    void exhaustive_search(const index_reader& reader,const std::vector<std::vector<posting_list_view>>& lists,size_t word_count,
+                           size_t topk,std::vector<InvertedElemPrint>* out) const {
+        static thread_local score_accumulator acc;
+        acc.prepare(reader.doc_count());
+        bool has_deleted = reader.has_deleted();
+        std::vector<int>& weights = acc.weights;
+        std::vector<uint64_t>& masks = acc.masks;
+        std::vector<uint32_t>& touched = acc.touched;
+        for(size_t i = 0;i<word_count;i++){
+            uint64_t bit = word_bit(i);
+            for(const posting_list_view& invertedList:lists[i]){
+                for(posting_iterator iter(invertedList);iter.valid();iter.next()){
+                    uint32_t id = iter.id();
+                    if(id>=weights.size()||(has_deleted&&reader.is_deleted(id))){
+                        continue;
+                    }
+                    if(masks[id] == 0){
+                        touched.push_back(id);
+                    }
+                    weights[id]+=iter.weight();
+                    masks[id]|=bit;
+                }
+            }
+        }
+        //只需要前topk个结果，用部分排序代替全排序
+        size_t end = std::min(touched.size(),topk);
+        std::partial_sort(touched.begin(),touched.begin()+end,touched.end(),[&weights](uint32_t a,uint32_t b){
+            return better_result(a,weights[a],b,weights[b]);
         });
+        out->reserve(end);
+        for(size_t i = 0;i<end;i++){
+            uint32_t id = touched[i];
+            out->emplace_back(id,weights[id],masks[id]);
+        }
+        acc.clear();
+    }
+
+    /**
+     * WAND / Block-Max WAND：按文档id从小到大逐个文档计算(document-at-a-time)
+     * 用一个大小为topk的小顶堆保存当前的前topk个结果，堆满后堆顶的权重就是门槛threshold，
+     * 之后的文档只有权重严格大于门槛才能进堆（权重相等时id小的优先，而之前进堆的文档id都更小）
+     * 1.把所有词按当前id排序，从前往后累加每个词整条拉链的最大权重，第一个使累加和超过门槛的词叫pivot，
+     *   id小于pivot的文档只可能出现在pivot之前的词里，它们的上界之和不超过门槛，可以整段跳过
+     * 2.Block-Max：再用pivot文档所在块的最大权重重新估计上界，仍然不超过门槛时，
+     *   这些块剩下的文档都不可能进堆，直接跳到这些块之后
+     * 3.前面的词都对齐到pivot文档后才真正计算权重
+     * 跳过的都是不可能进入前topk的文档，所以结果和全量统计完全一致
+     */
+    void wand_search(const index_reader& reader,const std::vector<std::vector<posting_list_view>>& lists,size_t word_count,
+                     size_t topk,std::vector<InvertedElemPrint>* out) const {
+        struct wand_cursor{
+            posting_iterator iter;
+            int max_weight;
+            size_t word;//在查询词中的下标
+        };
+        struct scored_doc{
+            uint64_t id;
+            int weight;
+            uint64_t mask;//命中的查询词
+        };
+        //游标、排序用的数组和堆都在查询之间复用
+        static thread_local std::vector<wand_cursor> cursors;
+        static thread_local std::vector<wand_cursor*> order;
+        static thread_local std::vector<scored_doc> heap;
+        cursors.clear();
+        order.clear();
+        heap.clear();
+        cursors.reserve(word_count);
+        for(size_t i = 0;i<word_count;i++){
+            //同一个词在不同段中的倒排拉链各自作为一个游标，文档id不相交，每个文档的权重只来自其中一个
+            for(const posting_list_view& invertedList:lists[i]){
+                cursors.push_back(wand_cursor{posting_iterator(invertedList),invertedList.max_weight_,i});
+            }
+        }
+        bool has_deleted = reader.has_deleted();
+        for(wand_cursor& cursor:cursors){
+            order.push_back(&cursor);
+        }
+        //堆顶是当前最差的结果
+        auto worse = [](const scored_doc& a,const scored_doc& b){
+            return better_result(a.id,a.weight,b.id,b.weight);
+        };
+        while(topk>0){
+            //去掉已经遍历完的词，剩下的按当前id排序
+            order.erase(std::remove_if(order.begin(),order.end(),[](wand_cursor* c){ return !c->iter.valid(); }),order.end());
+            if(order.empty()){
+                break;
+            }
+            std::sort(order.begin(),order.end(),[](wand_cursor* a,wand_cursor* b){
+                return a->iter.id()<b->iter.id();
+            });
+            bool full = heap.size()>=topk;
+            int threshold = full?heap.front().weight:-1;
+            //1.找pivot
+            int upper = 0;
+            size_t pivot = order.size();
+            for(size_t i = 0;i<order.size();i++){
+                upper+=order[i]->max_weight;
+                if(upper>threshold){
+                    pivot = i;
+                    break;
+                }
+            }
+            if(pivot == order.size()){
+                break;//剩下的文档都不可能进入前topk了
+            }
+            uint64_t pivot_id = order[pivot]->iter.id();
+            while(pivot+1<order.size()&&order[pivot+1]->iter.id() == pivot_id){
+                pivot++;
+            }
+            //2.用块内最大权重再检查一次
+            if(full){
+                int block_upper = 0;
+                uint64_t next_id = UINT64_MAX;
+                for(size_t i = 0;i<=pivot;i++){
+                    int block_max;
+                    uint64_t last_id;
+                    if(order[i]->iter.shallow_seek(pivot_id,&block_max,&last_id)){
+                        block_upper+=block_max;
+                        next_id = std::min(next_id,last_id+1);
+                    }
+                }
+                if(block_upper<=threshold){
+                    if(pivot+1<order.size()){
+                        next_id = std::min(next_id,order[pivot+1]->iter.id());
+                    }
+                    for(size_t i = 0;i<=pivot;i++){
+                        order[i]->iter.next_geq(next_id);
+                    }
+                    continue;
+                }
+            }
+            //3.前面的词都已经对齐到pivot文档，计算权重
+            if(order[0]->iter.id() == pivot_id){
+                scored_doc doc{pivot_id,0,0};
+                for(size_t i = 0;i<=pivot;i++){
+                    doc.weight+=order[i]->iter.weight();
+                    doc.mask|=word_bit(order[i]->word);
+                    order[i]->iter.next();
+                }
+                if(has_deleted&&reader.is_deleted(pivot_id)){
+                    continue;//已删除的文档不进入结果
+                }
+                if(!full){
+                    heap.push_back(doc);
+                    std::push_heap(heap.begin(),heap.end(),worse);
+                }else if(doc.weight>threshold){
+                    std::pop_heap(heap.begin(),heap.end(),worse);
+                    heap.back() = doc;
+                    std::push_heap(heap.begin(),heap.end(),worse);
+                }
+            }else{
+                for(size_t i = 0;i<pivot;i++){
+                    order[i]->iter.next_geq(pivot_id);
+                }
+            }
+        }
+        std::sort(heap.begin(),heap.end(),worse);
+        out->reserve(heap.size());
+        for(const scored_doc& doc:heap){
+            out->emplace_back(doc.id,doc.weight,doc.mask);
+        }
+    }
 
-        //排完序后，开始获取正排索引
-        Json::Value root;
-        for(InvertedElemPrint&item:inverted_all){
-            Doc* tmp = index->get_forward_index(item.id_);
-            if(nullptr == tmp){
+    /**
+     * 带筛选条件的查询（见parse_query），按文档id从小到大逐个文档检查(document-at-a-time)：
+     * 1.候选文档：每组必须满足的条件提供候选来源，只有一个条件时它的每个词各是一个来源；
+     *   多个条件用OR连起来时，每个条件取倒排拉链最短的词，合起来作为一个来源（包含这一组所有可能满足的文档）。
+     *   来源按倒排拉链从短到长排好，后面的来源依次用next_geq跳到当前候选id，有来源跳过了它就从新的id重新开始(leapfrog)，
+     *   所有来源都停在同一个id上时才是候选文档。next_geq在块表上做指数查找，长的拉链大部分块都不会被解码
+     *   没有必须满足的条件（只有排除条件）时，所有查询词合起来作为一个来源，也就是按OR遍历
+     * 2.堆满之后和Block-Max WAND一样，用每个查询词当前块的最大权重之和估计上界，不超过门槛时整段跳到这些块之后
+     * 3.候选文档先算权重（命中的所有查询词的权重之和，和全量统计一致），进不了前topk的直接跳过，
+     *   剩下的再检查每组条件：短语检查位置，title:检查标题，排除组中有任何条件满足的去掉
+     * 跳过的都是不可能进入前topk的文档，结果和把所有文档逐个检查一遍完全一致
+     */
+    void boolean_search(const index_reader& reader,const query_scratch& q,size_t topk,std::vector<InvertedElemPrint>* out) const {
+        struct source{
+            uint32_t begin;//来源包含的游标在members中的范围
+            uint32_t end;
+            uint64_t cost;
+        };
+        //游标、来源和堆都在查询之间复用
+        static thread_local std::vector<term_cursor> cursors;
+        static thread_local std::vector<term_cursor> excluded;
+        static thread_local std::vector<term_cursor*> members;
+        static thread_local std::vector<source> sources;
+        static thread_local std::vector<InvertedElemPrint> heap;
+        cursors.clear();
+        excluded.clear();
+        members.clear();
+        sources.clear();
+        heap.clear();
+        if(topk == 0||q.words.empty()){
+            return;
+        }
+        cursors.reserve(q.words.size());
+        for(size_t i = 0;i<q.words.size();i++){
+            cursors.emplace_back(q.lists[i]);
+        }
+        excluded.reserve(q.excluded.size());
+        for(size_t i = 0;i<q.excluded.size();i++){
+            excluded.emplace_back(q.excluded_lists[i]);
+        }
+        //1.候选来源
+        for(const query_clause& clause:q.clauses){
+            if(clause.occur!=query_clause::REQUIRED){
+                continue;
+            }
+            if(clause.atoms.size() == 1){
+                for(uint32_t word:clause.atoms[0].words){
+                    members.push_back(&cursors[word]);
+                    sources.push_back(source{(uint32_t)members.size()-1,(uint32_t)members.size(),cursors[word].cost()});
+                }
                 continue;
             }
-            //得到正排索引
-            Json::Value value;
-            value["title"] = tmp->title_;
-            // value["content"] = GetDesc(tmp->content_,item.words_[0]);
-            value["content"] = GetDescWithHighlight(tmp->content_, item.words_); 
-            value["url"] = tmp->url_;
-            root.append(value);
-        }
-        Json::FastWriter write;
-        json_res = write.write(root);
-    }
-
-    std::string GetDesc(const std::string& html_content,const std::string&word)
-    {
-      //节选部分内容
-      const int prev_step = 50;
-      const int next_step = 100;
-
-      //1.找到首次出现的位置
-      auto iter = std::search(html_content.begin(),html_content.end(),word.begin(),word.end(),[](int x,int y)
-          {
-          return (std::tolower(x) == std::tolower(y));
-          });
-      if(iter == html_content.end())
-      {
-        return "None1";
-      }
-      int pos = std::distance(html_content.begin(),iter);
-
-      //2.获取start，end下标
-      int start = 0;
-      int end = html_content.size() - 1;
-      //判断前方是否有足够字符
-      if(pos>start+prev_step) start = pos - prev_step;
-      if(pos<end-next_step) end = pos+next_step;
-
-      // 3.截取字串
-      if(start>=end) return "None2";
-      std::string desc = html_content.substr(start,end-start);
-      desc+="...";
-      return desc;
-    }
-    // 优化，带有语法高亮
-    std::string GetDescWithHighlight(const std::string& html_content, const std::vector<std::string>& words)
-    {
-        if (words.empty()) {
-            // 如果没有关键词，截取开头部分
-            return html_content.substr(0, 150) + "...";
-        }
-
-        const std::string& first_word = words[0]; // 简单起见，我们只高亮第一个词
-
-        // 1. 不区分大小写地查找首次出现的位置
-        auto it = std::search(html_content.begin(), html_content.end(), first_word.begin(), first_word.end(), 
-            [](char c1, char c2) {
-                return std::tolower(c1) == std::tolower(c2);
+            source group{(uint32_t)members.size(),0,0};
+            for(const query_atom& atom:clause.atoms){
+                term_cursor* shortest = &cursors[atom.words[0]];
+                for(uint32_t word:atom.words){
+                    if(cursors[word].cost()<shortest->cost()){
+                        shortest = &cursors[word];
+                    }
+                }
+                members.push_back(shortest);
+                group.cost+=shortest->cost();
+            }
+            group.end = members.size();
+            sources.push_back(group);
+        }
+        if(sources.empty()){
+            source all{0,0,0};
+            for(term_cursor& cursor:cursors){
+                members.push_back(&cursor);
+                all.cost+=cursor.cost();
+            }
+            all.end = members.size();
+            sources.push_back(all);
+        }
+        std::sort(sources.begin(),sources.end(),[](const source& a,const source& b){
+            return a.cost<b.cost;
+        });
+        //来源跳到第一个>=target的文档，返回它的id
+        auto advance = [](const source& from,uint64_t target){
+            uint64_t id = UINT64_MAX;
+            for(uint32_t k = from.begin;k<from.end;k++){
+                members[k]->next_geq(target);
+                id = std::min(id,members[k]->id());
+            }
+            return id;
+        };
+        //堆顶是当前最差的结果
+        auto worse = [](const InvertedElemPrint& a,const InvertedElemPrint& b){
+            return better_result(a.id_,a.weight_,b.id_,b.weight_);
+        };
+        bool has_deleted = reader.has_deleted();
+        //[candidate,bound_end]中的文档权重都不超过bound，bound_end为0表示需要重新估计
+        int bound = 0;
+        uint64_t bound_end = 0;
+        uint64_t candidate = advance(sources[0],0);
+        while(candidate!=UINT64_MAX){
+            if(heap.size()>=topk){
+                if(candidate>bound_end){
+                    bound = 0;
+                    bound_end = UINT64_MAX;
+                    for(term_cursor& cursor:cursors){
+                        int block_max;
+                        uint64_t last_id;
+                        if(cursor.block_max(candidate,&block_max,&last_id)){
+                            bound+=block_max;
+                            bound_end = std::min(bound_end,last_id);
+                        }
+                    }
+                }
+                if(bound<=heap.front().weight_){
+                    //堆里的文档id都更小，权重相等也进不了堆
+                    candidate = bound_end == UINT64_MAX?bound_end:advance(sources[0],bound_end+1);
+                    continue;
+                }
+            }
+            uint64_t next = candidate;
+            for(size_t i = 1;i<sources.size()&&next == candidate;i++){
+                next = advance(sources[i],candidate);
+            }
+            if(next!=candidate){
+                candidate = next == UINT64_MAX?next:advance(sources[0],next);
+                continue;
+            }
+            //2.算权重，能进入前topk时再检查条件
+            if(!has_deleted||!reader.is_deleted(candidate)){
+                InvertedElemPrint doc(candidate,0,0);
+                for(size_t i = 0;i<cursors.size();i++){
+                    if(cursors[i].seek(candidate)){
+                        doc.weight_+=cursors[i].weight();
+                        doc.mask_|=word_bit(i);
+                    }
+                }
+                bool full = heap.size()>=topk;
+                if((!full||worse(doc,heap.front()))&&match_clauses(reader,q,cursors,excluded,candidate)){
+                    if(full){
+                        std::pop_heap(heap.begin(),heap.end(),worse);
+                        heap.back() = doc;
+                    }else{
+                        heap.push_back(doc);
+                    }
+                    std::push_heap(heap.begin(),heap.end(),worse);
+                }
+            }
+            candidate = advance(sources[0],candidate+1);
+        }
+        std::sort(heap.begin(),heap.end(),worse);
+        out->insert(out->end(),heap.begin(),heap.end());
+    }
+
+    //文档id是否满足所有必须满足的组，并且不满足任何排除组；cursors、excluded为查询词、排除词的游标，id必须单调递增
+    static bool match_clauses(const index_reader& reader,const query_scratch& q,std::vector<term_cursor>& cursors,
+                              std::vector<term_cursor>& excluded,uint64_t id){
+        for(const query_clause& clause:q.clauses){
+            if(clause.occur == query_clause::OPTIONAL){
+                continue;
+            }
+            bool exclude = clause.occur == query_clause::EXCLUDED;
+            const std::vector<std::string>& words = exclude?q.excluded:q.words;
+            bool hit = false;
+            for(size_t i = 0;i<clause.atoms.size()&&!hit;i++){
+                hit = match_atom(reader,clause.atoms[i],words,exclude?excluded:cursors,id);
+            }
+            if(hit == exclude){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * 文档id是否满足一个条件：包含条件中的所有词；短语还要求这些词在同一个字段里按查询中的间隔出现，
+     * title:要求这些词出现在标题中（短语则要求在标题中按间隔出现）
+     * 索引没有保存位置信息时无法检查短语，只要求包含所有词；title:改为在正排索引的标题中查找这些词
+     */
+    static bool match_atom(const index_reader& reader,const query_atom& atom,const std::vector<std::string>& words,
+                           std::vector<term_cursor>& cursors,uint64_t id){
+        static thread_local std::vector<doc_positions> positions;
+        for(uint32_t word:atom.words){
+            if(!cursors[word].seek(id)){
+                return false;
+            }
+        }
+        if(!atom.phrase&&!atom.title){
+            return true;
+        }
+        if(positions.size()<atom.words.size()){
+            positions.resize(atom.words.size());
+        }
+        for(size_t i = 0;i<atom.words.size();i++){
+            if(cursors[atom.words[i]].positions(&positions[i]) == 0){
+                return !atom.title||title_contains(reader,atom,words,id);
+            }
+        }
+        if(atom.phrase){
+            return match_field(positions,atom,&doc_positions::title)||(!atom.title&&match_field(positions,atom,&doc_positions::content));
+        }
+        for(size_t i = 0;i<atom.words.size();i++){
+            if(positions[i].title.empty()){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //没有位置信息时检查title:：在文档的标题中查找条件中的每个词，ASCII字母不区分大小写
+    static bool title_contains(const index_reader& reader,const query_atom& atom,const std::vector<std::string>& words,uint64_t id){
+        DocView doc;
+        if(!reader.get_forward_index(id,&doc,false)){
+            return false;
+        }
+        for(uint32_t word:atom.words){
+            const std::string& target = words[word];
+            auto iter = std::search(doc.title_.begin(),doc.title_.end(),target.begin(),target.end(),[](char x,char y){
+                return ascii_lower(x) == (uint8_t)y;
             });
+            if(iter == doc.title_.end()){
+                return false;
+            }
+        }
+        return true;
+    }
 
-        if (it == html_content.end()) {
-            // 如果找不到，返回一个通用摘要
-            return html_content.substr(0, 150) + "...";
+    //短语中的第一个词出现在p时，其他词是否都出现在p+gap
+    static bool match_field(const std::vector<doc_positions>& positions,const query_atom& atom,std::vector<uint32_t> doc_positions::*field){
+        for(uint32_t p:positions[0].*field){
+            bool found = true;
+            for(size_t i = 1;i<atom.words.size()&&found;i++){
+                const std::vector<uint32_t>& list = positions[i].*field;
+                found = std::binary_search(list.begin(),list.end(),p+atom.gaps[i]);
+            }
+            if(found){
+                return true;
+            }
         }
+        return false;
+    }
 
-        int pos = std::distance(html_content.begin(), it);
-        
-        // 2. 确定截取范围
-        const int prev_step = 50;
-        const int next_step = 100;
-        
-        int start = (pos > prev_step) ? (pos - prev_step) : 0;
-        int end = (pos + first_word.length() + next_step < html_content.length()) ? (pos + first_word.length() + next_step) : html_content.length();
+    //查询中相邻的两个词在文档的一个字段中的加分：找出间隔最接近查询中间隔gap的一次出现
+    static int pair_bonus(const std::vector<uint32_t>& first,const std::vector<uint32_t>& second,uint32_t gap){
+        //两个序列都是升序的，target单调增加，second上的指针只向后移动
+        uint32_t best = PROXIMITY_WINDOW;
+        auto iter = second.begin();
+        for(uint32_t p:first){
+            uint32_t target = p+gap;
+            while(iter!=second.end()&&*iter<target){
+                iter++;
+            }
+            if(iter!=second.end()){
+                best = std::min(best,*iter-target);
+            }
+            if(iter!=second.begin()){
+                best = std::min(best,target-*(iter-1));
+            }
+            if(best == 0||iter == second.end()){
+                break;
+            }
+        }
+        return best<PROXIMITY_WINDOW?PROXIMITY_BONUS>>best:0;
+    }
 
-        // 3. 截取原始子串
-        std::string desc = html_content.substr(start, end - start);
+    /**
+     * 邻近度加分：对前PROXIMITY_DEPTH个结果，查询中相邻的每一对词在文档中的间隔越接近查询中的间隔，加分越多，
+     * title和content分别计算取较大值，加分后对这些结果重新排序
+     * 后面的结果不加分，权重都不超过前面的结果原来的权重，所以整体顺序仍然一致，翻页时结果稳定
+     */
+    void proximity_rerank(query_scratch& q,std::vector<InvertedElemPrint>* results) const {
+        const std::vector<proximity_pair>& pairs = q.pairs;
+        //按文档id升序处理，每个词在每个段上只用一个迭代器向后跳，同一个块只解码一次
+        //每个文档中每个词的位置只解码一次，states[i]为seek的返回值，2表示还没有查找
+        static thread_local std::vector<doc_positions> positions;
+        static thread_local std::vector<int> states;
+        static thread_local std::vector<uint32_t> order;
+        uint32_t word_count = 0;
+        for(const proximity_pair& pair:pairs){
+            word_count = std::max(word_count,pair.second+1);
+        }
+        if(positions.size()<word_count){
+            positions.resize(word_count);
+        }
+        std::vector<term_cursor>& cursors = q.cursors;
+        if(cursors.size()<word_count){
+            cursors.resize(word_count);
+        }
+        for(uint32_t i = 0;i<word_count;i++){
+            cursors[i].reset(q.lists[i]);
+        }
+        auto lookup = [&](uint32_t word,uint64_t id){
+            if(states[word] == 2){
+                states[word] = cursors[word].seek(id,&positions[word]);
+            }
+            return states[word]>0;
+        };
+        size_t depth = std::min(results->size(),PROXIMITY_DEPTH);
+        order.resize(depth);
+        for(uint32_t i = 0;i<depth;i++){
+            order[i] = i;
+        }
+        std::sort(order.begin(),order.end(),[results](uint32_t a,uint32_t b){
+            return (*results)[a].id_<(*results)[b].id_;
+        });
+        for(uint32_t i:order){
+            InvertedElemPrint& item = (*results)[i];
+            states.assign(word_count,2);
+            int bonus = 0;
+            for(const proximity_pair& pair:pairs){
+                if(!(item.mask_&word_bit(pair.first))||!(item.mask_&word_bit(pair.second))){
+                    continue;
+                }
+                if(!lookup(pair.first,item.id_)||!lookup(pair.second,item.id_)){
+                    continue;
+                }
+                const doc_positions& first = positions[pair.first];
+                const doc_positions& second = positions[pair.second];
+                bonus+=std::max(pair_bonus(first.title,second.title,pair.gap),pair_bonus(first.content,second.content,pair.gap));
+            }
+            item.weight_+=bonus;
+        }
+        std::sort(results->begin(),results->begin()+depth,[](const InvertedElemPrint& a,const InvertedElemPrint& b){
+            return better_result(a.id_,a.weight_,b.id_,b.weight_);
+        });
+    }
 
-        // 4. 在截取出的摘要中，高亮所有出现的关键词
-        // 这里为了简单，只高亮第一个词
-        std::string highlighted_word = "<em>" + first_word + "</em>";
-        
-        // 替换 (这里是一个简化的替换，实际中可能需要更复杂的正则替换来处理大小写)
-        size_t found_pos = desc.find(first_word);
-        if(found_pos != std::string::npos){
-            desc.replace(found_pos, first_word.length(), highlighted_word);
+    /**
+     * 根据位置信息生成摘要，不需要在正文中查找查询词：
+     * 1.取出文档命中的每个查询词在正文中的字节偏移
+     * 2.由snippet_builder选出包含不同查询词最多的一段，对齐到UTF-8字符边界后高亮这一段中出现的所有查询词
+     * 没有位置信息时扫描正文找出所有查询词（见highlight.hpp）；cursors下标和查询词一致，文档id需要单调递增
+     * 摘要直接转义成json字符串（带引号）追加到out
+     */
+    void make_snippet(query_scratch& q,std::vector<term_cursor>& cursors,const InvertedElemPrint& item,std::string_view content,std::string* out) const {
+        static thread_local doc_positions positions;
+        snippet_builder& snippets = q.snippets;
+        snippets.clear();
+        bool fallback = false;
+        for(size_t i = 0;i<q.words.size()&&!fallback;i++){
+            if(!(item.mask_&word_bit(i))||std::find(q.words.begin(),q.words.begin()+i,q.words[i])!=q.words.begin()+i){
+                continue;
+            }
+            int state = cursors[i].seek(item.id_,&positions);
+            fallback = state == 0;
+            if(state<=0){
+                continue;
+            }
+            //每个词的偏移本身是升序的，追加后和前面的部分归并即可，同一位置上长词优先
+            size_t middle = snippets.hit_count();
+            for(uint32_t offset:positions.offsets){
+                if(offset+q.words[i].size()<=content.size()){
+                    snippets.add_hit(offset,q.words[i].size(),i);
+                }
+            }
+            snippets.merge_hits(middle);
+        }
+        if(fallback||snippets.hit_count() == 0){
+            snippets.clear();
+            snippets.scan(content);
         }
-        
-        return "..." + desc + "...";
+        snippets.render(content,SNIPPET_BEFORE,SNIPPET_AFTER,out);
+    }
+private:
+    //把距上一次lap的时间记进一个阶段的直方图，返回这段时间
+    static uint64_t record_stage(latency_histogram& histogram,stopwatch& timer){
+        uint64_t ns = timer.lap();
+        histogram.record(ns);
+        return ns;
     }
 
-};
+    /**
+     * 按init_search记下的参数构造一份新的索引：
+     * 有快照时加载快照再应用变更日志，否则从raw.txt建索引、清空变更日志并写出快照
+     * 索引构造失败时*out仍然是一份空索引，返回false
+     */
+    bool open_index(std::shared_ptr<Index>* out){
+        std::shared_ptr<Index> fresh = std::make_shared<Index>();
+        *out = fresh;
+        if(!snapshot_file.empty()&&load_snapshot(fresh.get(),snapshot_file,mmap_snapshot)){
+            LOG(Level::INFO,"加载索引快照");
+            if(!delta_file.empty()){
+                fresh->apply_delta(delta_file);
+            }
+            fresh->build_suggestions();
+            return true;
+        }
+        if(!fresh->create_index(input_file)){
+            return false;
+        }
+        LOG(Level::INFO,"创建索引");
+        if(!delta_file.empty()){
+            fresh->reset_delta(delta_file);
+        }
+        if(!snapshot_file.empty()&&fresh->save_index(snapshot_file)&&mmap_snapshot){
+            //刚写出的快照直接映射进来，释放建索引时占用的堆内存
+            load_snapshot(fresh.get(),snapshot_file,mmap_snapshot);
+        }
+        fresh->build_suggestions();
+        return true;
+    }
 
+    static bool load_snapshot(Index* target,const std::string& snapshot,bool use_mmap){
+        return use_mmap?target->map_index(snapshot):target->load_index(snapshot);
+    }
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+/*
+yui的boost搜索引擎，联想篇
+输入框每输入一个字符前端就会请求一次/suggest，不能每次都走完整的搜索流程，所以单独建一棵前缀树：
+1.候选词就是基础索引词典(lexicon.hpp)中的词，按文档频率降序，文档频率一样时按字典序
+2.词典是有序的，同一前缀的词在词典中是连续的一段[first,last)，前缀树的节点只记录这段范围，不另外保存字符串
+3.只为以它为前缀的词超过SUGGEST_TOP_K个的前缀建节点，节点上预先算好前SUGGEST_TOP_K个补全；
+  其他前缀的词不超过SUGGEST_TOP_K个，从最深的节点往下直接在词典上二分找到这一段，当场排序即可
+4.节点和补全结果都放在连续的数组里，同一节点的子节点按字节升序连续存放，查询时只读，不申请内存
+前缀按字节匹配，ASCII字母的大小写由调用者统一转成小写（索引中的词都是小写的）
+只包含基础索引中的词，增量段中新出现的词要等重建快照后才会出现在联想结果中
+*/
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include "lexicon.hpp"
+
+//每个前缀最多给出的补全个数
+const size_t SUGGEST_TOP_K = 10;
+
+/**
+ * 输入联想用的前缀树，建好后只读，多个线程可以同时查询
+ * 前缀树引用建立它的词典，词典被替换或者释放之前需要重新build或者clear
+ */
+class suggester{
+public:
+    void build(const lexicon& terms){
+        terms_ = &terms;
+        nodes_.clear();
+        top_.clear();
+        nodes_.push_back(node{0,(uint32_t)terms.size(),0,0,0,0,0});
+        std::vector<uint32_t> depths(1,0);//每个节点的前缀长度
+        std::vector<uint32_t> candidates;
+        //按层建立，处理一个节点时把它的子节点追加到末尾，同一节点的子节点自然是连续的
+        for(size_t i = 0;i<nodes_.size();i++){
+            uint32_t first = nodes_[i].first,last = nodes_[i].last;
+            size_t depth = depths[i];
+            candidates.clear();
+            for(uint32_t t = first;t<last;t++){
+                candidates.push_back(t);
+            }
+            size_t k = std::min(candidates.size(),SUGGEST_TOP_K);
+            std::partial_sort(candidates.begin(),candidates.begin()+k,candidates.end(),[this](uint32_t a,uint32_t b){
+                return heavier(a,b);
+            });
+            nodes_[i].top_begin = top_.size();
+            nodes_[i].top_count = k;
+            top_.insert(top_.end(),candidates.begin(),candidates.begin()+k);
+            //按第depth个字节分组，和前缀本身相同的词排在最前面，不属于任何子节点
+            nodes_[i].child_begin = nodes_.size();
+            uint32_t t = first;
+            if(t<last&&terms.word_at(t).size() == depth){
+                t++;
+            }
+            while(t<last){
+                uint8_t byte = terms.word_at(t)[depth];
+                uint32_t end = t+1;
+                while(end<last&&(uint8_t)terms.word_at(end)[depth] == byte){
+                    end++;
+                }
+                if(end-t>SUGGEST_TOP_K){
+                    nodes_.push_back(node{t,end,0,0,0,byte,0});
+                    depths.push_back(depth+1);
+                }
+                t = end;
+            }
+            nodes_[i].child_count = nodes_.size()-nodes_[i].child_begin;
+        }
+        nodes_.shrink_to_fit();
+        top_.shrink_to_fit();
+    }
+
+    void clear(){
+        terms_ = nullptr;
+        std::vector<node>().swap(nodes_);
+        std::vector<uint32_t>().swap(top_);
+    }
+
+    //以prefix开头的词中文档频率最高的至多count个（不超过SUGGEST_TOP_K），
+    //把它们在词典中的下标按文档频率降序写入out，返回个数
+    size_t suggest(std::string_view prefix,uint32_t* out,size_t count) const {
+        count = std::min(count,SUGGEST_TOP_K);
+        if(nodes_.empty()||count == 0){
+            return 0;
+        }
+        const node* current = &nodes_[0];
+        size_t depth = 0;
+        while(depth<prefix.size()){
+            const node* begin = nodes_.data()+current->child_begin;
+            const node* end = begin+current->child_count;
+            uint8_t byte = prefix[depth];
+            const node* child = std::lower_bound(begin,end,byte,[](const node& item,uint8_t key){
+                return item.byte<key;
+            });
+            if(child == end||child->byte!=byte){
+                break;
+            }
+            current = child;
+            depth++;
+        }
+        if(depth == prefix.size()){
+            size_t n = std::min(count,(size_t)current->top_count);
+            std::copy(top_.begin()+current->top_begin,top_.begin()+current->top_begin+n,out);
+            return n;
+        }
+        //没有节点说明以prefix开头的词不超过SUGGEST_TOP_K个
+        std::pair<uint64_t,uint64_t> range = terms_->prefix_range(prefix);
+        //最多SUGGEST_TOP_K个，边取边插入排序
+        std::array<uint32_t,SUGGEST_TOP_K> candidates;
+        size_t n = 0;
+        for(uint64_t t = range.first;t<range.second&&n<candidates.size();t++){
+            size_t i = n++;
+            for(;i>0&&heavier((uint32_t)t,candidates[i-1]);i--){
+                candidates[i] = candidates[i-1];
+            }
+            candidates[i] = t;
+        }
+        n = std::min(n,count);
+        std::copy(candidates.begin(),candidates.begin()+n,out);
+        return n;
+    }
+
+    size_t node_count() const {
+        return nodes_.size();
+    }
+private:
+    struct node{
+        uint32_t first;//以这个节点的前缀开头的词在词典中的下标范围[first,last)
+        uint32_t last;
+        uint32_t child_begin;//子节点在nodes_中的下标
+        uint32_t top_begin;//预先算好的补全在top_中的下标
+        uint16_t child_count;
+        uint8_t byte;//从父节点到这个节点的字节
+        uint8_t top_count;
+    };
+
+    //文档频率高的在前，一样时字典序小的在前
+    bool heavier(uint32_t a,uint32_t b) const {
+        uint32_t wa = terms_->postings_at(a).count,wb = terms_->postings_at(b).count;
+        return wa!=wb?wa>wb:a<b;
+    }
+private:
+    const lexicon* terms_ = nullptr;
+    std::vector<node> nodes_;
+    std::vector<uint32_t> top_;
+};
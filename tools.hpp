@@ -2,9 +2,16 @@
 #include <boost/algorithm/string.hpp>
 #include "cppjieba/Jieba.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include "Log.hpp"
 #include <mutex>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
 /**
 boost库的字符串切割函数
 头文件：#include <boost/algorithm/string.hpp>
@@ -27,6 +34,140 @@ void split_string(std::string&str,std::vector<std::string>&res,const std::string
 }
 
 
+/**
+ * 有界阻塞队列，用于多线程流水线中阶段之间传递数据
+ * push：队列满时阻塞，保证上游不会把数据无限堆在内存里
+ * pop：队列空时阻塞，队列关闭并且取空后返回false
+ * close：上游结束时调用，唤醒所有等待的线程
+ */
+template<class T>
+class block_queue{
+public:
+    explicit block_queue(size_t capacity)
+    :capacity_(capacity)
+    {}
+    void push(T item){
+        std::unique_lock<std::mutex> lock(mtx_);
+        not_full_.wait(lock,[this]{ return queue_.size()<capacity_||closed_; });
+        queue_.push_back(std::move(item));
+        not_empty_.notify_one();
+    }
+    bool pop(T* item){
+        std::unique_lock<std::mutex> lock(mtx_);
+        not_empty_.wait(lock,[this]{ return !queue_.empty()||closed_; });
+        if(queue_.empty()){
+            return false;
+        }
+        *item = std::move(queue_.front());
+        queue_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+    void close(){
+        std::unique_lock<std::mutex> lock(mtx_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+private:
+    std::deque<T> queue_;
+    size_t capacity_;
+    bool closed_ = false;
+    std::mutex mtx_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+
+//分词结果中的一个词：offset、len为词在原字符串中的字节范围，position为词的序号
+struct token_pos{
+    uint32_t offset;
+    uint32_t len;
+    uint32_t position;
+};
+
+/**
+ * 一段文本的分词结果，text是原文的拷贝，ASCII字母已经转成小写（和原文等长，偏移不变），词都指向text
+ * 调用者把它放在thread_local或者长期存在的对象里反复使用，text和tokens的容量只增不减，分词时不再为每个词申请内存
+ */
+struct token_list{
+    std::string text;
+    std::vector<token_pos> tokens;
+
+    size_t size() const {
+        return tokens.size();
+    }
+    std::string_view word(const token_pos& token) const {
+        return std::string_view(text.data()+token.offset,token.len);
+    }
+    std::string_view word(size_t i) const {
+        return word(tokens[i]);
+    }
+};
+
+/**
+ * 停用词表：建好后只读的开放寻址哈希表，线性探测，装载因子不超过1/2
+ * 所有词连续存放在strings_里，槽中只记录偏移、长度和哈希值的高16位，
+ * 查找时直接用string_view比较，不构造std::string；比最长的停用词还长的词不用算哈希
+ */
+class stop_word_set{
+public:
+    void build(const std::vector<std::string>& words){
+        size_t count = 1;
+        while(count<words.size()*2+1){
+            count*=2;
+        }
+        slots_.assign(count,slot{0,0,0});
+        strings_.clear();
+        max_len_ = 0;
+        for(const std::string& word:words){
+            if(word.empty()||word.size()>UINT16_MAX||contains(word)){
+                continue;
+            }
+            uint64_t h = hash(word);
+            size_t pos = h&(slots_.size()-1);
+            while(slots_[pos].len!=0){
+                pos = (pos+1)&(slots_.size()-1);
+            }
+            slots_[pos] = slot{(uint32_t)strings_.size(),(uint16_t)word.size(),(uint16_t)(h>>48)};
+            strings_+=word;
+            max_len_ = std::max(max_len_,word.size());
+        }
+    }
+    bool contains(std::string_view word) const {
+        if(word.size()>max_len_||word.empty()){
+            return false;
+        }
+        uint64_t h = hash(word);
+        uint16_t tag = h>>48;
+        for(size_t pos = h&(slots_.size()-1);slots_[pos].len!=0;pos = (pos+1)&(slots_.size()-1)){
+            const slot& item = slots_[pos];
+            if(item.tag == tag&&item.len == word.size()&&memcmp(strings_.data()+item.offset,word.data(),word.size()) == 0){
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    struct slot{
+        uint32_t offset;
+        uint16_t len;//0表示空槽
+        uint16_t tag;
+    };
+    //FNV-1a
+    static uint64_t hash(std::string_view word){
+        uint64_t h = 0xcbf29ce484222325ull;
+        for(char ch:word){
+            h = (h^(uint8_t)ch)*0x100000001b3ull;
+        }
+        return h^(h>>29);
+    }
+private:
+    std::string strings_;
+    std::vector<slot> slots_;
+    size_t max_len_ = 0;
+};
+
 const char* const DICT_PATH = "./dict/jieba.dict.utf8";
 const char* const HMM_PATH = "./dict/hmm_model.utf8";
 const char* const USER_DICT_PATH = "./dict/user.dict.utf8";
@@ -37,26 +178,32 @@ const char* const STOP_WORD_PATH = "./dict/stop_words.utf8";
   {
     private:
       cppjieba::Jieba jieba;
-      std::unordered_map<std::string,bool> stop_words;
+      //和jieba共用词典和HMM模型，直接在rune数组上做搜索模式分词，切出的词只是rune的范围，不生成std::string
+      cppjieba::QuerySegment query_seg;
+      stop_word_set stop_words;
     private:
       JiebaUtil()
         :jieba(DICT_PATH,HMM_PATH,USER_DICT_PATH,IDF_PATH,STOP_WORD_PATH)
+        ,query_seg(jieba.GetDictTrie(),jieba.GetHMMModel())
       {}
       JiebaUtil(const JiebaUtil&) = delete ;
     public:
+      //双重检查加锁，instance用原子变量发布，其他线程看到非空指针时对象一定已经初始化完成
       static JiebaUtil* get_instance()
       {
-        if(nullptr == instance)
+        JiebaUtil* tmp = instance.load(std::memory_order_acquire);
+        if(nullptr == tmp)
         {
-          mtx.lock();
-          if(nullptr == instance)
+          std::lock_guard<std::mutex> lock(mtx);
+          tmp = instance.load(std::memory_order_relaxed);
+          if(nullptr == tmp)
           {
-            instance = new JiebaUtil();
-            instance->InitJiebaUtil();
+            tmp = new JiebaUtil();
+            tmp->InitJiebaUtil();
+            instance.store(tmp,std::memory_order_release);
           }
-          mtx.unlock();
         }
-        return instance;
+        return tmp;
       }
       void InitJiebaUtil()
       {
@@ -66,38 +213,105 @@ const char* const STOP_WORD_PATH = "./dict/stop_words.utf8";
           LOG(Level::FATAL,"load stop wordsfile error");
           return;
         }
+        std::vector<std::string> words;
         std::string line;
         while(std::getline(in,line))
         {
-          stop_words.insert({line,true});
+          words.push_back(line);
         }
         in.close();
+        stop_words.build(words);
+      }
+      //初始化之后jieba和停用词表都只读，多个线程可以同时分词，分词结果写在调用者自己的out里
+      //搜索模式分词并去掉停用词，词保持原文的大小写
+      void CutStringHelper(const std::string& src,std::vector<std::string>*out) const
+      {
+        static thread_local token_list tokens;
+        CutTokensHelper(src,&tokens);
+        out->clear();
+        out->reserve(tokens.size());
+        for(const token_pos& token:tokens.tokens)
+        {
+          out->emplace_back(src,token.offset,token.len);
+        }
       }
-      void CutStringHelper(const std::string& src,std::vector<std::string>*out)
+      //搜索模式分词，去掉停用词，同时带回每个词的序号和字节偏移，词在out->text中已经转成小写
+      //搜索模式会先输出从长词中切出来的短词，再输出长词本身，下一个长词从上一个长词的结尾开始，
+      //所以一个词的结尾不超过下一个词的起点时它就是长词；短词和它所属的长词序号相同，每个长词占一个序号
+      //停用词不输出但是照样占用序号，短语中间的停用词不会让前后两个词看起来相邻
+      //和cppjieba的CutForSearch切出的词相同，只是跳过了它为每个词生成std::string的部分：
+      //原文解码成rune后按分隔符切段，每段交给QuerySegment，结果是rune的范围，换算成字节偏移即可；
+      //停用词直接用原文的string_view查表，大小写转换对整段文本做一次
+      //rune数组和词的范围数组是每个线程一份的，只增不减，cppjieba在每段内部仍会申请少量临时数组
+      void CutTokensHelper(std::string_view src,token_list* out) const
       {
-        jieba.CutForSearch(src,*out);
-        for(auto iter = out->begin();iter != out->end();)
+        static thread_local std::vector<cppjieba::RuneStr> runes;
+        static thread_local std::vector<cppjieba::WordRange> ranges;
+        out->tokens.clear();
+        out->text.assign(src.data(),src.size());
+        for(char& ch:out->text)
         {
-          auto it = stop_words.find(*iter);
-          if(it!=stop_words.end())
+          if(ch>='A'&&ch<='Z') ch+='a'-'A';
+        }
+        //和cppjieba::DecodeRunesInString一样，不是合法的UTF-8时整段都不分词
+        runes.clear();
+        for(uint32_t i = 0;i<src.size();)
+        {
+          cppjieba::RuneStrLite rune = cppjieba::DecodeRuneInString(src.data()+i,src.size()-i);
+          if(rune.len == 0)
           {
-            //说明当前的string是暂停词，需要去除
-            iter = out->erase(iter);
+            return;
           }
-          else
+          runes.emplace_back(rune.rune,i,rune.len,runes.size(),1);
+          i+=rune.len;
+        }
+        //和cppjieba::PreFilter一样切段：分隔符单独成一段，其余连续的rune成一段
+        ranges.clear();
+        const cppjieba::RuneStr* end = runes.data()+runes.size();
+        for(const cppjieba::RuneStr* begin = runes.data();begin<end;)
+        {
+          const cppjieba::RuneStr* stop = begin+1;
+          if(!IsSeparator(begin->rune))
           {
-            iter++;
+            while(stop<end&&!IsSeparator(stop->rune)) stop++;
           }
+          query_seg.Cut(begin,stop,ranges,true);
+          begin = stop;
         }
+        out->tokens.reserve(ranges.size());
+        uint32_t position = 0;
+        for(size_t i = 0;i<ranges.size();i++)
+        {
+          uint32_t offset = ranges[i].left->offset;
+          uint32_t len = ranges[i].right->offset+ranges[i].right->len-offset;
+          if(!stop_words.contains(src.substr(offset,len)))
+          {
+            out->tokens.push_back(token_pos{offset,len,position});
+          }
+          if(i+1 == ranges.size()||ranges[i+1].left->offset>=offset+len)
+          {
+            position++;
+          }
+        }
+      }
+    private:
+      //cppjieba默认的分隔符（cppjieba::SPECIAL_SEPARATORS）：空格、制表符、换行、全角逗号、句号
+      static bool IsSeparator(cppjieba::Rune rune)
+      {
+        return rune == ' '||rune == '\t'||rune == '\n'||rune == 0xFF0C||rune == 0x3002;
       }
     public:
       static void CutString(const std::string&src,std::vector<std::string>*out)
       {
         JiebaUtil::get_instance()->CutStringHelper(src,out);
       }
+      static void CutTokens(std::string_view src,token_list*out)
+      {
+        JiebaUtil::get_instance()->CutTokensHelper(src,out);
+      }
     private:
-      static JiebaUtil* instance;
+      static std::atomic<JiebaUtil*> instance;
       static std::mutex mtx;
   };
-  JiebaUtil* JiebaUtil::instance = nullptr;
+  std::atomic<JiebaUtil*> JiebaUtil::instance{nullptr};
   std::mutex JiebaUtil::mtx;